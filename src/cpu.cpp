@@ -0,0 +1,291 @@
+#include "cpu.hpp"
+#include "math.hpp"
+#include "simd.hpp"
+
+#if defined(ARCH_INTEL) && defined(USE_SIMD)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define target_sse2
+#define target_avx2
+#define target_avx512
+#else
+#include <cpuid.h>
+#define target_sse2 __attribute__((target("sse2")))
+#define target_avx2 __attribute__((target("avx2")))
+#define target_avx512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+namespace blib3d::cpu
+{
+
+//------------------------------------------------------------------------------
+// scalar
+
+static void fill_scalar(uint32_t* dst, uint32_t value, uint32_t count)
+{
+#if defined(USE_SIMD) && !defined(ARCH_INTEL)
+    // wide stores of the target vector unit, there is no streaming store
+    simd::u32x4 v{ simd::set1(value) };
+    for (; count >= 4; count -= 4, dst += 4)
+        simd::store(dst, v);
+#endif
+    while (count--)
+        *dst++ = value;
+}
+
+template<bool use_min>
+static void reduce_scalar(float* dst, const float* row0, const float* row1, uint32_t count)
+{
+    for (uint32_t n{ 0 }; n < count; ++n)
+    {
+        float a{ use_min ? math::depth_min(row0[0], row0[1]) : math::depth_max(row0[0], row0[1]) };
+        float b{ use_min ? math::depth_min(row1[0], row1[1]) : math::depth_max(row1[0], row1[1]) };
+        dst[n] = use_min ? math::depth_min(a, b) : math::depth_max(a, b);
+        row0 += 2;
+        row1 += 2;
+    }
+}
+
+#if defined(ARCH_INTEL) && defined(USE_SIMD)
+
+//------------------------------------------------------------------------------
+// sse2
+
+target_sse2 static void fill_sse2(uint32_t* dst, uint32_t value, uint32_t count)
+{
+    __m128i v{ _mm_set1_epi32((int32_t)value) };
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+    fill_scalar(dst, value, count);
+}
+
+// non-temporal stores from the first aligned address, the lines are not read
+target_sse2 static void fill_stream_sse2(uint32_t* dst, uint32_t value, uint32_t count)
+{
+    for (; count && (reinterpret_cast<uintptr_t>(dst) & 15); --count)
+        *dst++ = value;
+    __m128i v{ _mm_set1_epi32((int32_t)value) };
+    for (; count >= 4; count -= 4, dst += 4)
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), v);
+    _mm_sfence();
+    fill_scalar(dst, value, count);
+}
+
+template<bool use_min>
+target_sse2 static void reduce_sse2(float* dst, const float* row0, const float* row1, uint32_t count)
+{
+    for (; count >= 4; count -= 4, dst += 4, row0 += 8, row1 += 8)
+    {
+        __m128 a{ use_min ?
+            _mm_min_ps(_mm_loadu_ps(row0 + 0), _mm_loadu_ps(row1 + 0)) :
+            _mm_max_ps(_mm_loadu_ps(row0 + 0), _mm_loadu_ps(row1 + 0)) };
+        __m128 b{ use_min ?
+            _mm_min_ps(_mm_loadu_ps(row0 + 4), _mm_loadu_ps(row1 + 4)) :
+            _mm_max_ps(_mm_loadu_ps(row0 + 4), _mm_loadu_ps(row1 + 4)) };
+        __m128 even{ _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)) };
+        __m128 odd{ _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)) };
+        _mm_storeu_ps(dst, use_min ? _mm_min_ps(even, odd) : _mm_max_ps(even, odd));
+    }
+    reduce_scalar<use_min>(dst, row0, row1, count);
+}
+
+//------------------------------------------------------------------------------
+// avx2
+
+target_avx2 static void fill_avx2(uint32_t* dst, uint32_t value, uint32_t count)
+{
+    __m256i v{ _mm256_set1_epi32((int32_t)value) };
+    for (; count >= 8; count -= 8, dst += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), v);
+    fill_scalar(dst, value, count);
+}
+
+target_avx2 static void fill_stream_avx2(uint32_t* dst, uint32_t value, uint32_t count)
+{
+    for (; count && (reinterpret_cast<uintptr_t>(dst) & 31); --count)
+        *dst++ = value;
+    __m256i v{ _mm256_set1_epi32((int32_t)value) };
+    for (; count >= 8; count -= 8, dst += 8)
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst), v);
+    _mm_sfence();
+    fill_scalar(dst, value, count);
+}
+
+template<bool use_min>
+target_avx2 static void reduce_avx2(float* dst, const float* row0, const float* row1, uint32_t count)
+{
+    for (; count >= 8; count -= 8, dst += 8, row0 += 16, row1 += 16)
+    {
+        __m256 a{ use_min ?
+            _mm256_min_ps(_mm256_loadu_ps(row0 + 0), _mm256_loadu_ps(row1 + 0)) :
+            _mm256_max_ps(_mm256_loadu_ps(row0 + 0), _mm256_loadu_ps(row1 + 0)) };
+        __m256 b{ use_min ?
+            _mm256_min_ps(_mm256_loadu_ps(row0 + 8), _mm256_loadu_ps(row1 + 8)) :
+            _mm256_max_ps(_mm256_loadu_ps(row0 + 8), _mm256_loadu_ps(row1 + 8)) };
+        // per 128 bit lane, 64 bit pairs are then in order 0 2 1 3
+        __m256 even{ _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)) };
+        __m256 odd{ _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)) };
+        __m256 r{ use_min ? _mm256_min_ps(even, odd) : _mm256_max_ps(even, odd) };
+        r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(dst, r);
+    }
+    reduce_sse2<use_min>(dst, row0, row1, count);
+}
+
+//------------------------------------------------------------------------------
+// avx512
+
+target_avx512 static void fill_avx512(uint32_t* dst, uint32_t value, uint32_t count)
+{
+    __m512i v{ _mm512_set1_epi32((int32_t)value) };
+    for (; count >= 16; count -= 16, dst += 16)
+        _mm512_storeu_si512(dst, v);
+    fill_scalar(dst, value, count);
+}
+
+target_avx512 static void fill_stream_avx512(uint32_t* dst, uint32_t value, uint32_t count)
+{
+    for (; count && (reinterpret_cast<uintptr_t>(dst) & 63); --count)
+        *dst++ = value;
+    __m512i v{ _mm512_set1_epi32((int32_t)value) };
+    for (; count >= 16; count -= 16, dst += 16)
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst), v);
+    _mm_sfence();
+    fill_scalar(dst, value, count);
+}
+
+// the plain min/max intrinsics merge into an undefined vector that gcc reports
+// as maybe uninitialized, the zero masked form with a full mask is the same op
+template<bool use_min>
+target_avx512 static __m512 min_max_avx512(__m512 a, __m512 b)
+{
+    return use_min ?
+        _mm512_maskz_min_ps((__mmask16)0xffff, a, b) :
+        _mm512_maskz_max_ps((__mmask16)0xffff, a, b);
+}
+
+template<bool use_min>
+target_avx512 static void reduce_avx512(float* dst, const float* row0, const float* row1, uint32_t count)
+{
+    const __m512i even_index{ _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0) };
+    const __m512i odd_index{ _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1) };
+    for (; count >= 16; count -= 16, dst += 16, row0 += 32, row1 += 32)
+    {
+        __m512 a{ min_max_avx512<use_min>(_mm512_loadu_ps(row0 + 0), _mm512_loadu_ps(row1 + 0)) };
+        __m512 b{ min_max_avx512<use_min>(_mm512_loadu_ps(row0 + 16), _mm512_loadu_ps(row1 + 16)) };
+        __m512 even{ _mm512_permutex2var_ps(a, even_index, b) };
+        __m512 odd{ _mm512_permutex2var_ps(a, odd_index, b) };
+        _mm512_storeu_ps(dst, min_max_avx512<use_min>(even, odd));
+    }
+    reduce_sse2<use_min>(dst, row0, row1, count);
+}
+
+//------------------------------------------------------------------------------
+// detection
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t reg[4])
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (uint32_t n{ 0 }; n < 4; ++n)
+        reg[n] = (uint32_t)r[n];
+#else
+    if (!__get_cpuid_count(leaf, subleaf, &reg[0], &reg[1], &reg[2], &reg[3]))
+        reg[0] = reg[1] = reg[2] = reg[3] = 0;
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+uint32_t detect_level()
+{
+    uint32_t reg[4];
+    cpuid(0, 0, reg);
+    uint32_t max_leaf{ reg[0] };
+
+    cpuid(1, 0, reg);
+    if (!(reg[3] & (1u << 26))) // sse2
+        return LEVEL_SCALAR;
+    if (!(reg[2] & (1u << 27)) || !(reg[2] & (1u << 28)) || max_leaf < 7) // osxsave avx
+        return LEVEL_SSE2;
+
+    // os saves the xmm ymm state, and the opmask zmm state for avx512
+    uint64_t xcr0{ xgetbv0() };
+    if ((xcr0 & 0x06) != 0x06)
+        return LEVEL_SSE2;
+
+    cpuid(7, 0, reg);
+    if (!(reg[1] & (1u << 5))) // avx2
+        return LEVEL_SSE2;
+    if (!(reg[1] & (1u << 16)) || (xcr0 & 0xE0) != 0xE0) // avx512f
+        return LEVEL_AVX2;
+    return LEVEL_AVX512;
+}
+
+#else
+
+uint32_t detect_level()
+{
+    return LEVEL_SCALAR;
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+
+static constexpr kernel_table level_kernels[]
+{
+    { fill_scalar, fill_scalar, reduce_scalar<true>, reduce_scalar<false> },
+#if defined(ARCH_INTEL) && defined(USE_SIMD)
+    { fill_sse2, fill_stream_sse2, reduce_sse2<true>, reduce_sse2<false> },
+    { fill_avx2, fill_stream_avx2, reduce_avx2<true>, reduce_avx2<false> },
+    { fill_avx512, fill_stream_avx512, reduce_avx512<true>, reduce_avx512<false> },
+#endif
+};
+
+static uint32_t selected_level{ LEVEL_SCALAR };
+
+kernel_table kernels{ level_kernels[LEVEL_SCALAR] };
+
+void setup()
+{
+    // thread safe, once
+    static const bool done{ (set_level(LEVEL_AVX512), true) };
+    (void)done;
+}
+
+void set_level(uint32_t level)
+{
+    static const uint32_t detected{ detect_level() };
+    if (level > detected)
+        level = detected;
+    selected_level = level;
+    kernels = level_kernels[level];
+}
+
+uint32_t get_level()
+{
+    return selected_level;
+}
+
+const char* get_level_name(uint32_t level)
+{
+    static const char* names[]{ "scalar", "sse2", "avx2", "avx512" };
+    return level <= LEVEL_AVX512 ? names[level] : "";
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace blib3d::cpu
@@ -0,0 +1,47 @@
+#pragma once
+#include "shared.hpp"
+
+namespace blib3d::cpu
+{
+
+// instruction set levels, kernels are built for each level and selected at run time
+enum
+{
+    LEVEL_SCALAR,
+    LEVEL_SSE2,
+    LEVEL_AVX2,
+    LEVEL_AVX512
+};
+
+// best level supported by the cpu and the os, cpuid on ARCH_INTEL with USE_SIMD
+uint32_t detect_level();
+
+// detect once and select the best kernels, called by the renderer constructor
+void setup();
+
+// select the kernels of level, clamped to the detected level
+void set_level(uint32_t level);
+
+uint32_t get_level();
+
+const char* get_level_name(uint32_t level);
+
+//------------------------------------------------------------------------------
+
+struct kernel_table
+{
+    // count 32 bit values
+    void (*fill)(uint32_t* dst, uint32_t value, uint32_t count);
+
+    // fill with non-temporal stores, for large buffers not read back soon
+    void (*fill_stream)(uint32_t* dst, uint32_t value, uint32_t count);
+
+    // dst[n] is the min or max of the 2x2 block at row0[2 * n], row1[2 * n]
+    void (*reduce_min)(float* dst, const float* row0, const float* row1, uint32_t count);
+    void (*reduce_max)(float* dst, const float* row0, const float* row1, uint32_t count);
+};
+
+// kernels of the selected level
+extern kernel_table kernels;
+
+} // namespace blib3d::cpu
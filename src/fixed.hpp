@@ -0,0 +1,252 @@
+#pragma once
+#include "shared.hpp"
+#include <cstring>
+
+namespace blib3d::math
+{
+
+/*
+    signed 32.32 fixed point number for targets without FPU (USE_FIXED_POINT)
+
+    a single wide format covers the whole pipeline without per stage scaling:
+    clip space coordinates, screen coordinates, 1/w down to the far plane
+    and the gradients of attribute/w across the screen
+
+    multiply and divide only use 32x32->64 integer products and 64 bit
+    shift/add, no 128 bit types and no integer division: divide multiplies
+    by a newton-raphson reciprocal of the normalized divisor (relative
+    error below 2^-29)
+    float input is converted with integer bit operations, constructors from
+    float/double are meant for constants (folded at compile time)
+*/
+struct fixed
+{
+    static constexpr int32_t frac_bits{ 32 };
+    static constexpr int64_t one{ (int64_t)1 << frac_bits };
+
+    int64_t raw;
+
+    fixed() = default;
+    constexpr fixed(int32_t v) : raw{ (int64_t)v * one } {}
+    constexpr fixed(uint32_t v) : raw{ (int64_t)v * one } {}
+    constexpr fixed(float v) : raw{ (int64_t)(v * (float)one) } {}
+    constexpr fixed(double v) : raw{ (int64_t)(v * (double)one) } {}
+
+    static constexpr fixed from_raw(int64_t v)
+    {
+        fixed r{};
+        r.raw = v;
+        return r;
+    }
+
+    // truncate toward zero, same as float to int cast
+    explicit operator int32_t() const
+    {
+        return (int32_t)(raw >= 0 ? raw >> frac_bits : -(-raw >> frac_bits));
+    }
+
+    static force_inline uint64_t mul_u(uint64_t a, uint64_t b)
+    {
+        uint64_t a_hi{ a >> 32 };
+        uint64_t a_lo{ a & 0xFFFFFFFFu };
+        uint64_t b_hi{ b >> 32 };
+        uint64_t b_lo{ b & 0xFFFFFFFFu };
+        return ((a_hi * b_hi) << 32) + a_hi * b_lo + a_lo * b_hi + ((a_lo * b_lo) >> 32);
+    }
+
+    static force_inline int64_t mul(int64_t a, int64_t b)
+    {
+        uint64_t r{ mul_u(a < 0 ? 0 - (uint64_t)a : (uint64_t)a, b < 0 ? 0 - (uint64_t)b : (uint64_t)b) };
+        return (a ^ b) < 0 ? -(int64_t)r : (int64_t)r;
+    }
+
+    static inline int64_t div(int64_t a, int64_t b)
+    {
+        uint64_t ua{ a < 0 ? 0 - (uint64_t)a : (uint64_t)a };
+        uint64_t ub{ b < 0 ? 0 - (uint64_t)b : (uint64_t)b };
+        bool neg{ (a ^ b) < 0 };
+        if (ub == 0)
+            return neg ? INT64_MIN : INT64_MAX;
+        int32_t s{ clz64(ub) };
+        if (s == 63)
+        {
+            if (ua >> 31)
+                return neg ? INT64_MIN : INT64_MAX;
+            return neg ? -(int64_t)(ua << frac_bits) : (int64_t)(ua << frac_bits);
+        }
+        // divisor normalized to [0.5, 1) in 0.32, reciprocal in 2.30 by
+        // newton-raphson from the linear estimate 48/17 - 32/17 * d
+        uint32_t d{ (uint32_t)((ub << s) >> 32) };
+        uint32_t r{ 3031741621u - (uint32_t)(((uint64_t)2021161081u * d) >> 32) };
+        for (int32_t n{ 0 }; n < 3; ++n)
+        {
+            uint32_t e{ (uint32_t)(((uint64_t)d * r) >> 32) };
+            r = (uint32_t)(((uint64_t)r * ((1u << 31) - e)) >> 30);
+        }
+        // quotient raw = ua * r * 2^(s - 62)
+        uint64_t hi{ (ua >> 32) * r };
+        uint64_t lo{ (ua & 0xFFFFFFFFu) * r };
+        int32_t sh{ 62 - s };
+        uint64_t q;
+        if (sh >= 32)
+            q = (hi + (lo >> 32)) >> (sh - 32);
+        else
+        {
+            if (hi >> (31 + sh))
+                return neg ? INT64_MIN : INT64_MAX;
+            q = (hi << (32 - sh)) + (lo >> sh);
+        }
+        if (q >> 63)
+            return neg ? INT64_MIN : INT64_MAX;
+        return neg ? -(int64_t)q : (int64_t)q;
+    }
+
+    friend constexpr fixed operator+(fixed a, fixed b) { return from_raw(a.raw + b.raw); }
+    friend constexpr fixed operator-(fixed a, fixed b) { return from_raw(a.raw - b.raw); }
+    friend constexpr fixed operator-(fixed a) { return from_raw(-a.raw); }
+    friend force_inline fixed operator*(fixed a, fixed b) { return from_raw(mul(a.raw, b.raw)); }
+    friend inline fixed operator/(fixed a, fixed b) { return from_raw(div(a.raw, b.raw)); }
+
+    fixed& operator+=(fixed v) { raw += v.raw; return *this; }
+    fixed& operator-=(fixed v) { raw -= v.raw; return *this; }
+    fixed& operator*=(fixed v) { raw = mul(raw, v.raw); return *this; }
+    fixed& operator/=(fixed v) { raw = div(raw, v.raw); return *this; }
+
+    friend constexpr bool operator==(fixed a, fixed b) { return a.raw == b.raw; }
+    friend constexpr bool operator!=(fixed a, fixed b) { return a.raw != b.raw; }
+    friend constexpr bool operator<(fixed a, fixed b) { return a.raw < b.raw; }
+    friend constexpr bool operator>(fixed a, fixed b) { return a.raw > b.raw; }
+    friend constexpr bool operator<=(fixed a, fixed b) { return a.raw <= b.raw; }
+    friend constexpr bool operator>=(fixed a, fixed b) { return a.raw >= b.raw; }
+
+    // depth test against float depth buffer, integer compare
+    friend force_inline bool operator>(float a, fixed b) { return float_key(a) > float_key(to_float(b)); }
+
+    static force_inline int32_t clz64(uint64_t v)
+    {
+#if defined(__GNUC__)
+        return __builtin_clzll(v);
+#else
+        int32_t n{ 0 };
+        if (!(v & 0xFFFFFFFF00000000u)) { n += 32; v <<= 32; }
+        if (!(v & 0xFFFF000000000000u)) { n += 16; v <<= 16; }
+        if (!(v & 0xFF00000000000000u)) { n +=  8; v <<=  8; }
+        if (!(v & 0xF000000000000000u)) { n +=  4; v <<=  4; }
+        if (!(v & 0xC000000000000000u)) { n +=  2; v <<=  2; }
+        if (!(v & 0x8000000000000000u)) { n +=  1; }
+        return n;
+#endif
+    }
+
+    // float bits as signed integer with the same ordering as float
+    static force_inline int32_t float_key(float v)
+    {
+        int32_t i;
+        std::memcpy(&i, &v, sizeof(i));
+        return i ^ ((i >> 31) & 0x7FFFFFFF);
+    }
+
+    // truncate
+    static force_inline float to_float(fixed v)
+    {
+        uint64_t u{ v.raw < 0 ? 0 - (uint64_t)v.raw : (uint64_t)v.raw };
+        if (u == 0)
+            return 0.f;
+        int32_t n{ 63 - clz64(u) };
+        uint32_t m{ (uint32_t)(n >= 23 ? u >> (n - 23) : u << (23 - n)) };
+        uint32_t bits{ (v.raw < 0 ? 0x80000000u : 0u) | ((uint32_t)(n - frac_bits + 127) << 23) | (m & 0x007FFFFFu) };
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // truncate, saturate
+    static force_inline fixed from_float(float v)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        int32_t e{ (int32_t)((bits >> 23) & 0xFF) };
+        if (e == 0)
+            return from_raw(0);
+        uint64_t m{ (bits & 0x007FFFFFu) | 0x00800000u };
+        int32_t shift{ e - 127 - 23 + frac_bits };
+        uint64_t u;
+        if (shift > 39)
+            u = INT64_MAX;
+        else if (shift >= 0)
+            u = m << shift;
+        else if (shift > -24)
+            u = m >> -shift;
+        else
+            u = 0;
+        return from_raw(bits >> 31 ? -(int64_t)u : (int64_t)u);
+    }
+};
+
+inline int32_t floor(fixed v)
+{
+    return (int32_t)(v.raw >> fixed::frac_bits);
+}
+
+inline int32_t ceil(fixed v)
+{
+    return (int32_t)((v.raw + (fixed::one - 1)) >> fixed::frac_bits);
+}
+
+inline fixed abs(fixed v)
+{
+    return fixed::from_raw(v.raw < 0 ? -v.raw : v.raw);
+}
+
+// assume v is positive
+inline int32_t log2ceil(fixed v)
+{
+    uint64_t u{ (uint64_t)v.raw };
+    int32_t n{ 63 - fixed::clz64(u) };
+    return n - fixed::frac_bits + ((u & ~((uint64_t)1 << n)) != 0);
+}
+
+// 16 fraction bits of precision
+inline fixed sqrt(fixed v)
+{
+    if (v.raw <= 0)
+        return fixed::from_raw(0);
+    uint64_t x{ (uint64_t)v.raw };
+    uint64_t r{ 0 };
+    uint64_t b{ (uint64_t)1 << ((63 - fixed::clz64(x)) & ~1) };
+    while (b)
+    {
+        if (x >= r + b)
+        {
+            x -= r + b;
+            r = (r >> 1) + b;
+        }
+        else
+            r >>= 1;
+        b >>= 2;
+    }
+    return fixed::from_raw((int64_t)(r << (fixed::frac_bits / 2)));
+}
+
+inline fixed cross2(fixed ax, fixed ay, fixed bx, fixed by)
+{
+    return ax * by - ay * bx;
+};
+
+inline void mul4x4t_3(fixed out[4], const fixed a[16], const fixed b[3])
+{
+    out[0] = a[0] * b[0] + a[4] * b[1] + a[ 8] * b[2] + a[12];
+    out[1] = a[1] * b[0] + a[5] * b[1] + a[ 9] * b[2] + a[13];
+    out[2] = a[2] * b[0] + a[6] * b[1] + a[10] * b[2] + a[14];
+    out[3] = a[3] * b[0] + a[7] * b[1] + a[11] * b[2] + a[15];
+}
+
+inline void mul4x4t_4(fixed out[4], const fixed a[16], const fixed b[4])
+{
+    out[0] = a[0] * b[0] + a[4] * b[1] + a[ 8] * b[2] + a[12] * b[3];
+    out[1] = a[1] * b[0] + a[5] * b[1] + a[ 9] * b[2] + a[13] * b[3];
+    out[2] = a[2] * b[0] + a[6] * b[1] + a[10] * b[2] + a[14] * b[3];
+    out[3] = a[3] * b[0] + a[7] * b[1] + a[11] * b[2] + a[15] * b[3];
+}
+
+} // namespace blib3d::math
@@ -0,0 +1,198 @@
+#include "impostor.hpp"
+
+namespace blib3d::impostor
+{
+
+//------------------------------------------------------------------------------
+
+void reset(cache& c)
+{
+    for (uint32_t n{ 0 }; n < c.slot_count; ++n)
+        c.slots[n].used = false;
+    c.frame = 0;
+}
+
+void next_frame(cache& c)
+{
+    c.frame++;
+}
+
+void invalidate(cache& c, uint32_t key)
+{
+    for (uint32_t n{ 0 }; n < c.slot_count; ++n)
+        if (c.slots[n].used && c.slots[n].key == key)
+            c.slots[n].used = false;
+}
+
+//------------------------------------------------------------------------------
+
+bool project(
+    bounds& out,
+    const math::mat4x4 geometry,
+    const math::mat4x4 frame,
+    const math::vec3 center,
+    float radius)
+{
+    math::mat4x4 m;
+    math::mul4x4_4x4(m, frame, geometry);
+
+    float x{ m[ 0] * center[0] + m[ 1] * center[1] + m[ 2] * center[2] + m[ 3] };
+    float y{ m[ 4] * center[0] + m[ 5] * center[1] + m[ 6] * center[2] + m[ 7] };
+    float z{ m[ 8] * center[0] + m[ 9] * center[1] + m[10] * center[2] + m[11] };
+    float w{ m[12] * center[0] + m[13] * center[1] + m[14] * center[2] + m[15] };
+
+    // nearest w of the sphere
+    float w_near{ w - radius * math::sqrt(m[12] * m[12] + m[13] * m[13] + m[14] * m[14]) };
+    if (w_near < math::to_float(render::clip_w_min))
+        return false;
+
+    float winv{ 1.f / w };
+    float sx{ x * winv };
+    float sy{ y * winv };
+
+    // screen gradient of the sphere points, (row - screen * w row) / w, taken at the nearest w
+    math::vec3 gx{ m[0] - sx * m[12], m[1] - sx * m[13], m[2] - sx * m[14] };
+    math::vec3 gy{ m[4] - sy * m[12], m[5] - sy * m[13], m[6] - sy * m[14] };
+    float rx{ radius * math::sqrt(math::dot3(gx, gx)) / w_near };
+    float ry{ radius * math::sqrt(math::dot3(gy, gy)) / w_near };
+
+    out.rect[0] = sx - rx;
+    out.rect[1] = sy - ry;
+    out.rect[2] = sx + rx;
+    out.rect[3] = sy + ry;
+    out.depth = z * winv;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static float normalize(math::vec3 out, const math::vec3 in)
+{
+    float length{ math::sqrt(math::dot3(in, in)) };
+    float inv{ length > 0.f ? 1.f / length : 0.f };
+    out[0] = in[0] * inv;
+    out[1] = in[1] * inv;
+    out[2] = in[2] * inv;
+    return length;
+}
+
+uint32_t acquire(
+    cache& c,
+    uint32_t key,
+    const math::vec3 view,
+    const math::vec3 up,
+    bool& capture)
+{
+    math::vec3 view_dir;
+    math::vec3 up_dir;
+    float distance{ normalize(view_dir, view) };
+    normalize(up_dir, up);
+
+    // slot of key, else the first free slot, else the least recently used one
+
+    uint32_t found{ c.slot_count };
+    uint32_t oldest{ 0 };
+    for (uint32_t n{ 0 }; n < c.slot_count; ++n)
+    {
+        const slot& s{ c.slots[n] };
+        if (s.used && s.key == key)
+        {
+            found = n;
+            break;
+        }
+        const slot& o{ c.slots[oldest] };
+        if (o.used && (!s.used || s.last_use < o.last_use))
+            oldest = n;
+    }
+
+    slot* s;
+    if (found < c.slot_count)
+    {
+        s = &c.slots[found];
+        capture =
+            math::dot3(view_dir, s->view) < c.view_threshold ||
+            math::dot3(up_dir, s->up) < c.view_threshold ||
+            math::abs(distance - s->distance) > c.distance_threshold * s->distance;
+    }
+    else
+    {
+        found = oldest;
+        s = &c.slots[found];
+        s->key = key;
+        s->used = true;
+        capture = true;
+    }
+
+    if (capture)
+    {
+        math::copy3(s->view, view_dir);
+        math::copy3(s->up, up_dir);
+        s->distance = distance;
+    }
+    s->last_use = c.frame;
+    return found;
+}
+
+//------------------------------------------------------------------------------
+
+void capture_begin(
+    render::renderer& r,
+    cache& c,
+    uint32_t slot,
+    const bounds& b,
+    const math::mat4x4 geometry,
+    const math::mat4x4 frame)
+{
+    uint32_t offset{ c.size * c.size * slot };
+    r.set_frame_data(c.size, c.size, c.size, c.depth + offset, c.color + offset);
+    r.set_frame_clear_depth(FLT_MAX);
+
+    // the bounds rect to the image, after the frame transform
+    float kx{ (float)c.size / (b.rect[2] - b.rect[0]) };
+    float ky{ (float)c.size / (b.rect[3] - b.rect[1]) };
+    math::mat4x4 rect_matrix
+    {
+        kx, 0, 0, -b.rect[0] * kx,
+        0, ky, 0, -b.rect[1] * ky,
+        0, 0, 1, 0,
+        0, 0, 0, 1
+    };
+    math::mat4x4 frame_matrix;
+    math::mul4x4_4x4(frame_matrix, rect_matrix, frame);
+    math::mat4x4 geometry_matrix;
+    math::copy4x4(geometry_matrix, geometry);
+    r.set_frame_transform(frame_matrix);
+    r.set_geometry_transform(geometry_matrix);
+
+    c.slots[slot].depth = b.depth;
+
+    r.render_begin();
+    r.render_clear();
+}
+
+void capture_end(render::renderer& r)
+{
+    r.render_end();
+}
+
+//------------------------------------------------------------------------------
+
+void draw(render::renderer& r, const cache& c, uint32_t slot, const bounds& b)
+{
+    uint32_t offset{ c.size * c.size * slot };
+    raster::depth_image image{ (int32_t)c.size, (int32_t)c.size, c.color + offset, c.depth + offset };
+
+    render::sprite sp{};
+    sp.center[0] = (b.rect[0] + b.rect[2]) * 0.5f;
+    sp.center[1] = (b.rect[1] + b.rect[3]) * 0.5f;
+    sp.size[0] = b.rect[2] - b.rect[0];
+    sp.size[1] = b.rect[3] - b.rect[1];
+    sp.depth = b.depth - c.slots[slot].depth;
+    sp.tex_rect[2] = 1.f;
+    sp.tex_rect[3] = 1.f;
+    r.render_depth_image(image, sp);
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace blib3d::impostor
@@ -0,0 +1,91 @@
+#pragma once
+#include "render.hpp"
+
+namespace blib3d::impostor
+{
+
+/*
+    impostor cache, an object is rendered once into a color and depth image and then
+    drawn as one screen rect (renderer::render_depth_image) until the view direction,
+    the camera up vector or the distance moves beyond the thresholds
+    images are size * size pixels, slot_count of them in user memory, an object
+    without a slot takes the least recently used one
+*/
+struct slot
+{
+    uint32_t key; // object id
+    bool used;
+    uint32_t last_use; // cache frame
+    float view[3]; // unit view direction at capture
+    float up[3]; // unit camera up vector at capture
+    float distance; // view distance at capture
+    float depth; // center depth at capture
+};
+
+struct cache
+{
+    slot* slots;
+    uint32_t slot_count;
+    uint32_t size; // image width and height
+    raster::ARGB* color; // size * size * slot_count
+    float* depth; // size * size * slot_count
+    float view_threshold; // minimum cosine between the capture and the current view and up
+    float distance_threshold; // maximum distance change relative to the capture distance
+    uint32_t frame;
+};
+
+// screen rect of an object bounding sphere
+struct bounds
+{
+    float rect[4]; // screen x0 y0 x1 y1
+    float depth; // center depth
+};
+
+// free all slots
+void reset(cache& c);
+
+// slots used before this call become older than the slots used after it
+void next_frame(cache& c);
+
+// the next acquire of key captures again, after the object changed
+void invalidate(cache& c, uint32_t key);
+
+// geometry and frame transforms as renderer::set_geometry_transform and set_frame_transform
+// false if the sphere reaches behind the viewer, draw the object instead
+bool project(
+    bounds& out,
+    const math::mat4x4 geometry,
+    const math::mat4x4 frame,
+    const math::vec3 center,
+    float radius);
+
+// slot of key, capture is set if the slot has to be rendered, see capture_begin
+// view is the object to camera vector and up the camera up vector, in the same space
+// for all the calls of key, linear search of the slots
+uint32_t acquire(
+    cache& c,
+    uint32_t key,
+    const math::vec3 view,
+    const math::vec3 up,
+    bool& capture);
+
+/*
+    set the frame buffers and transforms of r to render the object of bounds b into
+    the slot image, then begin and clear, draw the object with r and call capture_end
+    r is a renderer for captures with the linear layout, without fast clear, depth epochs,
+    or bins that do not store the depth
+*/
+void capture_begin(
+    render::renderer& r,
+    cache& c,
+    uint32_t slot,
+    const bounds& b,
+    const math::mat4x4 geometry,
+    const math::mat4x4 frame);
+
+void capture_end(render::renderer& r);
+
+// draw the slot image in the rect of b, the image depth moves by the change of the center depth
+void draw(render::renderer& r, const cache& c, uint32_t slot, const bounds& b);
+
+} // namespace blib3d::impostor
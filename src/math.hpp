@@ -1,9 +1,10 @@
 #pragma once
 #include "shared.hpp"
+#include "fixed.hpp"
 #include <cmath>
 
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-#include <xmmintrin.h>
+#if defined(USE_SIMD)
+#include "simd.hpp"
 #endif
 
 namespace blib3d::math
@@ -23,6 +24,65 @@ typedef float vec4[4];
 typedef float mat3x3[9]; // 00, 01, 02, 10, 11, 12, 20, 21, 22
 typedef float mat4x4[16]; // 00, 01, 02, 03, 10, 11, 12, 13, 20, 21, 22, 23, 30, 31, 32, 33
 
+// pipeline number type, see USE_FIXED_POINT
+
+#if defined(USE_FIXED_POINT)
+
+using real = fixed;
+
+inline real to_real(float v)
+{
+    return fixed::from_float(v);
+}
+
+inline float to_float(real v)
+{
+    return fixed::to_float(v);
+}
+
+// float depth buffer values, integer compare
+inline bool depth_less(float a, float b)
+{
+    return fixed::float_key(a) < fixed::float_key(b);
+}
+
+#else
+
+using real = float;
+
+inline real to_real(float v)
+{
+    return v;
+}
+
+inline float to_float(real v)
+{
+    return v;
+}
+
+inline bool depth_less(float a, float b)
+{
+    return a < b;
+}
+
+#endif
+
+inline float depth_min(float a, float b)
+{
+    return depth_less(a, b) ? a : b;
+}
+
+inline float depth_max(float a, float b)
+{
+    return depth_less(b, a) ? a : b;
+}
+
+inline void to_real(real* out, const float* in, uint32_t count)
+{
+    while (count--)
+        *out++ = to_real(*in++);
+}
+
 // common
 
 template<typename data_type>
@@ -59,6 +119,11 @@ inline int32_t ceil(float v)
     return r;
 }
 
+inline float abs(float v)
+{
+    return std::abs(v);
+}
+
 // bits
 
 // is_power_of_2(0) = false
@@ -146,9 +211,13 @@ inline float log2(float v)
     return std::log2(v);
 }
 
+// assume v is positive
 inline int32_t log2(int32_t v)
 {
-    return log2floor((float)v);
+    int32_t r{ 0 };
+    while (v >>= 1)
+        ++r;
+    return r;
 }
 
 inline float invsqrt(float v)
@@ -176,8 +245,8 @@ inline void copy3(vec3 out, const vec3 in)
 
 inline void copy4(vec3 out, const vec3 in)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    _mm_storeu_ps(out, _mm_loadu_ps(in));
+#if defined(USE_SIMD)
+    simd::store(out, simd::load(in));
 #else
     out[0] = in[0];
     out[1] = in[1];
@@ -188,9 +257,9 @@ inline void copy4(vec3 out, const vec3 in)
 
 inline void copy3x3(mat3x3 out, const mat3x3 in)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    _mm_storeu_ps(out + 0, _mm_loadu_ps(in + 0));
-    _mm_storeu_ps(out + 4, _mm_loadu_ps(in + 4));
+#if defined(USE_SIMD)
+    simd::store(out + 0, simd::load(in + 0));
+    simd::store(out + 4, simd::load(in + 4));
 #else
     out[0] = in[0];
     out[1] = in[1];
@@ -206,11 +275,11 @@ inline void copy3x3(mat3x3 out, const mat3x3 in)
 
 inline void copy4x4(mat4x4 out, const mat4x4 in)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    _mm_storeu_ps(out +  0, _mm_loadu_ps(in +  0));
-    _mm_storeu_ps(out +  4, _mm_loadu_ps(in +  4));
-    _mm_storeu_ps(out +  8, _mm_loadu_ps(in +  8));
-    _mm_storeu_ps(out + 12, _mm_loadu_ps(in + 12));
+#if defined(USE_SIMD)
+    simd::store(out +  0, simd::load(in +  0));
+    simd::store(out +  4, simd::load(in +  4));
+    simd::store(out +  8, simd::load(in +  8));
+    simd::store(out + 12, simd::load(in + 12));
 #else
     out[ 0] = in[ 0];
     out[ 1] = in[ 1];
@@ -266,8 +335,8 @@ inline void mul3(vec3 inout, const float a)
 
 inline void mul4(vec4 inout, const float a)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    _mm_storeu_ps(inout, _mm_mul_ps(_mm_loadu_ps(inout), _mm_load1_ps(&a)));
+#if defined(USE_SIMD)
+    simd::store(inout, simd::load(inout) * simd::set1(a));
 #else
     inout[0] *= a;
     inout[1] *= a;
@@ -312,14 +381,11 @@ inline void mul3x3_3x3(mat3x3 out, const mat3x3 a, const mat3x3 b)
 
 inline void mul4x4t_3(vec4 out, const mat4x4 a, const vec3 b)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    __m128 t0{ _mm_mul_ps(_mm_loadu_ps(a + 0), _mm_load_ps1(b + 0)) };
-    __m128 t1{ _mm_mul_ps(_mm_loadu_ps(a + 4), _mm_load_ps1(b + 1)) };
-    __m128 t2{ _mm_mul_ps(_mm_loadu_ps(a + 8), _mm_load_ps1(b + 2)) };
-    __m128 t3{ _mm_add_ps(t0, t1) };
-    __m128 t4{ _mm_add_ps(t2, _mm_loadu_ps(a + 12)) };
-    __m128 t5{ _mm_add_ps(t3, t4) };
-    _mm_storeu_ps(out, t5);
+#if defined(USE_SIMD)
+    simd::f32x4 t0{ simd::load(a + 0) * simd::set1(b[0]) };
+    simd::f32x4 t1{ simd::load(a + 4) * simd::set1(b[1]) };
+    simd::f32x4 t2{ simd::load(a + 8) * simd::set1(b[2]) };
+    simd::store(out, (t0 + t1) + (t2 + simd::load(a + 12)));
 #else
     out[0] = a[0] * b[0] + a[4] * b[1] + a[ 8] * b[2] + a[12];
     out[1] = a[1] * b[0] + a[5] * b[1] + a[ 9] * b[2] + a[13];
@@ -330,15 +396,12 @@ inline void mul4x4t_3(vec4 out, const mat4x4 a, const vec3 b)
 
 inline void mul4x4t_4(vec4 out, const mat4x4 a, const vec4 b)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    __m128 t0{ _mm_mul_ps(_mm_loadu_ps(a +  0), _mm_load_ps1(b + 0)) };
-    __m128 t1{ _mm_mul_ps(_mm_loadu_ps(a +  4), _mm_load_ps1(b + 1)) };
-    __m128 t2{ _mm_mul_ps(_mm_loadu_ps(a +  8), _mm_load_ps1(b + 2)) };
-    __m128 t3{ _mm_mul_ps(_mm_loadu_ps(a + 12), _mm_load_ps1(b + 3)) };
-    __m128 t4{ _mm_add_ps(t0, t1) };
-    __m128 t5{ _mm_add_ps(t2, t3) };
-    __m128 t6{ _mm_add_ps(t4, t5) };
-    _mm_storeu_ps(out, t6);
+#if defined(USE_SIMD)
+    simd::f32x4 t0{ simd::load(a +  0) * simd::set1(b[0]) };
+    simd::f32x4 t1{ simd::load(a +  4) * simd::set1(b[1]) };
+    simd::f32x4 t2{ simd::load(a +  8) * simd::set1(b[2]) };
+    simd::f32x4 t3{ simd::load(a + 12) * simd::set1(b[3]) };
+    simd::store(out, (t0 + t1) + (t2 + t3));
 #else
     out[0] = a[0] * b[0] + a[4] * b[1] + a[ 8] * b[2] + a[12] * b[3];
     out[1] = a[1] * b[0] + a[5] * b[1] + a[ 9] * b[2] + a[13] * b[3];
@@ -349,44 +412,19 @@ inline void mul4x4t_4(vec4 out, const mat4x4 a, const vec4 b)
 
 inline void mul4x4_4x4(mat4x4 out, const mat4x4 a, const mat4x4 b)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    __m128 t0, t1, t2, t3, t4, t5, t6;
-    __m128 b0{ _mm_loadu_ps(b +  0) };
-    __m128 b1{ _mm_loadu_ps(b +  4) };
-    __m128 b2{ _mm_loadu_ps(b +  8) };
-    __m128 b3{ _mm_loadu_ps(b + 12) };
-    t0 = _mm_mul_ps(_mm_load_ps1(a +  0), b0);
-    t1 = _mm_mul_ps(_mm_load_ps1(a +  1), b1);
-    t2 = _mm_mul_ps(_mm_load_ps1(a +  2), b2);
-    t3 = _mm_mul_ps(_mm_load_ps1(a +  3), b3);
-    t4 = _mm_add_ps(t0, t1);
-    t5 = _mm_add_ps(t2, t3);
-    t6 = _mm_add_ps(t4, t5);
-    _mm_storeu_ps(out +  0, t6);
-    t0 = _mm_mul_ps(_mm_load_ps1(a +  4), b0);
-    t1 = _mm_mul_ps(_mm_load_ps1(a +  5), b1);
-    t2 = _mm_mul_ps(_mm_load_ps1(a +  6), b2);
-    t3 = _mm_mul_ps(_mm_load_ps1(a +  7), b3);
-    t4 = _mm_add_ps(t0, t1);
-    t5 = _mm_add_ps(t2, t3);
-    t6 = _mm_add_ps(t4, t5);
-    _mm_storeu_ps(out +  4, t6);
-    t0 = _mm_mul_ps(_mm_load_ps1(a +  9), b0);
-    t1 = _mm_mul_ps(_mm_load_ps1(a +  8), b1);
-    t2 = _mm_mul_ps(_mm_load_ps1(a + 10), b2);
-    t3 = _mm_mul_ps(_mm_load_ps1(a + 11), b3);
-    t4 = _mm_add_ps(t0, t1);
-    t5 = _mm_add_ps(t2, t3);
-    t6 = _mm_add_ps(t4, t5);
-    _mm_storeu_ps(out +  8, t6);
-    t0 = _mm_mul_ps(_mm_load_ps1(a + 12), b0);
-    t1 = _mm_mul_ps(_mm_load_ps1(a + 13), b1);
-    t2 = _mm_mul_ps(_mm_load_ps1(a + 14), b2);
-    t3 = _mm_mul_ps(_mm_load_ps1(a + 15), b3);
-    t4 = _mm_add_ps(t0, t1);
-    t5 = _mm_add_ps(t2, t3);
-    t6 = _mm_add_ps(t4, t5);
-    _mm_storeu_ps(out + 12, t6);
+#if defined(USE_SIMD)
+    simd::f32x4 b0{ simd::load(b +  0) };
+    simd::f32x4 b1{ simd::load(b +  4) };
+    simd::f32x4 b2{ simd::load(b +  8) };
+    simd::f32x4 b3{ simd::load(b + 12) };
+    for (uint32_t n{ 0 }; n < 16; n += 4)
+    {
+        simd::f32x4 t0{ simd::set1(a[n + 0]) * b0 };
+        simd::f32x4 t1{ simd::set1(a[n + 1]) * b1 };
+        simd::f32x4 t2{ simd::set1(a[n + 2]) * b2 };
+        simd::f32x4 t3{ simd::set1(a[n + 3]) * b3 };
+        simd::store(out + n, (t0 + t1) + (t2 + t3));
+    }
 #else
     out[ 0] = a[ 0] * b[ 0] + a[ 1] * b[ 4] + a[ 2] * b[ 8] + a[ 3] * b[12];
     out[ 1] = a[ 0] * b[ 1] + a[ 1] * b[ 5] + a[ 2] * b[ 9] + a[ 3] * b[13];
@@ -424,19 +462,19 @@ inline void trn3x3(mat3x3 out, const mat3x3 in)
 
 inline void trn4x4(mat4x4 out, const mat4x4 in)
 {
-#if defined(ARCH_INTEL) && defined(USE_SIMD)
-    __m128 a0{ _mm_loadu_ps(in +  0) };
-    __m128 a1{ _mm_loadu_ps(in +  4) };
-    __m128 a2{ _mm_loadu_ps(in +  8) };
-    __m128 a3{ _mm_loadu_ps(in + 12) };
-    __m128 t0{ _mm_unpacklo_ps(a0, a1) };
-    __m128 t1{ _mm_unpacklo_ps(a2, a3) };
-    __m128 t2{ _mm_unpackhi_ps(a0, a1) };
-    __m128 t3{ _mm_unpackhi_ps(a2, a3) };
-    _mm_storeu_ps(out +  0, _mm_movelh_ps(t0, t1));
-    _mm_storeu_ps(out +  4, _mm_movehl_ps(t1, t0));
-    _mm_storeu_ps(out +  8, _mm_movelh_ps(t2, t3));
-    _mm_storeu_ps(out + 12, _mm_movehl_ps(t3, t2));
+#if defined(USE_SIMD)
+    simd::f32x4 a0{ simd::load(in +  0) };
+    simd::f32x4 a1{ simd::load(in +  4) };
+    simd::f32x4 a2{ simd::load(in +  8) };
+    simd::f32x4 a3{ simd::load(in + 12) };
+    simd::f32x4 t0{ simd::interleave_lo(a0, a1) };
+    simd::f32x4 t1{ simd::interleave_lo(a2, a3) };
+    simd::f32x4 t2{ simd::interleave_hi(a0, a1) };
+    simd::f32x4 t3{ simd::interleave_hi(a2, a3) };
+    simd::store(out +  0, simd::concat_lo(t0, t1));
+    simd::store(out +  4, simd::concat_hi(t0, t1));
+    simd::store(out +  8, simd::concat_lo(t2, t3));
+    simd::store(out + 12, simd::concat_hi(t2, t3));
 #else
     out[ 0] = in[ 0];
     out[ 1] = in[ 4];
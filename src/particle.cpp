@@ -0,0 +1,171 @@
+#include "particle.hpp"
+#include <cassert>
+
+#if defined(USE_SIMD)
+#include "simd.hpp"
+#endif
+
+namespace blib3d::particle
+{
+
+//------------------------------------------------------------------------------
+
+bool emit(buffer& b, const particle_data& p)
+{
+    if (b.count == b.capacity)
+        return false;
+
+    uint32_t n{ b.count++ };
+    b.position[0][n] = p.position[0];
+    b.position[1][n] = p.position[1];
+    b.position[2][n] = p.position[2];
+    b.velocity[0][n] = p.velocity[0];
+    b.velocity[1][n] = p.velocity[1];
+    b.velocity[2][n] = p.velocity[2];
+    b.color[0][n] = p.color[0];
+    b.color[1][n] = p.color[1];
+    b.color[2][n] = p.color[2];
+    b.color[3][n] = p.color[3];
+    b.color_speed[0][n] = p.color_speed[0];
+    b.color_speed[1][n] = p.color_speed[1];
+    b.color_speed[2][n] = p.color_speed[2];
+    b.color_speed[3][n] = p.color_speed[3];
+    b.size[n] = p.size;
+    b.life[n] = p.life;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void update(buffer& b, float time_step, const math::vec3 acceleration)
+{
+    assert((b.capacity & 3) == 0);
+
+    // integrate, groups of 4, the tail of the last group is unused capacity
+
+    uint32_t group_count{ (b.count + 3) >> 2 };
+
+#if defined(USE_SIMD)
+    simd::f32x4 dt{ simd::set1(time_step) };
+    simd::f32x4 dv[3]
+    {
+        simd::set1(acceleration[0] * time_step),
+        simd::set1(acceleration[1] * time_step),
+        simd::set1(acceleration[2] * time_step)
+    };
+    simd::f32x4 color_min{ simd::set1(0.f) };
+    simd::f32x4 color_max{ simd::set1(255.f) };
+    for (uint32_t ng{ 0 }; ng < group_count; ++ng)
+    {
+        uint32_t n{ ng << 2 };
+        for (uint32_t nc{ 0 }; nc < 3; ++nc)
+        {
+            simd::f32x4 v{ simd::load(&b.velocity[nc][n]) };
+            simd::f32x4 p{ simd::load(&b.position[nc][n]) };
+            simd::store(&b.position[nc][n], p + v * dt);
+            simd::store(&b.velocity[nc][n], v + dv[nc]);
+        }
+        for (uint32_t nc{ 0 }; nc < 4; ++nc)
+        {
+            simd::f32x4 c{ simd::load(&b.color[nc][n]) };
+            simd::f32x4 cs{ simd::load(&b.color_speed[nc][n]) };
+            c = c + cs * dt;
+            simd::store(&b.color[nc][n], simd::min(simd::max(c, color_min), color_max));
+        }
+        simd::store(&b.life[n], simd::load(&b.life[n]) - dt);
+    }
+#else
+    float dv[3]
+    {
+        acceleration[0] * time_step,
+        acceleration[1] * time_step,
+        acceleration[2] * time_step
+    };
+    for (uint32_t n{ 0 }; n < (group_count << 2); ++n)
+    {
+        for (uint32_t nc{ 0 }; nc < 3; ++nc)
+        {
+            b.position[nc][n] += b.velocity[nc][n] * time_step;
+            b.velocity[nc][n] += dv[nc];
+        }
+        for (uint32_t nc{ 0 }; nc < 4; ++nc)
+            b.color[nc][n] = math::clamp(b.color[nc][n] + b.color_speed[nc][n] * time_step, 0.f, 255.f);
+        b.life[n] -= time_step;
+    }
+#endif
+
+    // remove dead particles, move the last one in place
+
+    uint32_t n{ 0 };
+    while (n < b.count)
+    {
+        if (b.life[n] > 0.f)
+        {
+            ++n;
+            continue;
+        }
+        uint32_t last{ --b.count };
+        b.position[0][n] = b.position[0][last];
+        b.position[1][n] = b.position[1][last];
+        b.position[2][n] = b.position[2][last];
+        b.velocity[0][n] = b.velocity[0][last];
+        b.velocity[1][n] = b.velocity[1][last];
+        b.velocity[2][n] = b.velocity[2][last];
+        b.color[0][n] = b.color[0][last];
+        b.color[1][n] = b.color[1][last];
+        b.color[2][n] = b.color[2][last];
+        b.color[3][n] = b.color[3][last];
+        b.color_speed[0][n] = b.color_speed[0][last];
+        b.color_speed[1][n] = b.color_speed[1][last];
+        b.color_speed[2][n] = b.color_speed[2][last];
+        b.color_speed[3][n] = b.color_speed[3][last];
+        b.size[n] = b.size[last];
+        b.life[n] = b.life[last];
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void sort_descending(
+    uint32_t* key,
+    uint32_t* index,
+    uint32_t* tmp_key,
+    uint32_t* tmp_index,
+    uint32_t count)
+{
+    // 4 passes of 8 bits, stable, an even number of passes leaves the result in key
+
+    uint32_t* src_key{ key };
+    uint32_t* src_index{ index };
+    uint32_t* dst_key{ tmp_key };
+    uint32_t* dst_index{ tmp_index };
+
+    for (uint32_t shift{ 0 }; shift < 32; shift += 8)
+    {
+        uint32_t offset[256]{};
+        for (uint32_t n{ 0 }; n < count; ++n)
+            offset[255 - ((src_key[n] >> shift) & 0xFF)]++;
+        uint32_t sum{ 0 };
+        for (uint32_t n{ 0 }; n < 256; ++n)
+        {
+            uint32_t c{ offset[n] };
+            offset[n] = sum;
+            sum += c;
+        }
+        for (uint32_t n{ 0 }; n < count; ++n)
+        {
+            uint32_t k{ src_key[n] };
+            uint32_t d{ offset[255 - ((k >> shift) & 0xFF)]++ };
+            dst_key[d] = k;
+            dst_index[d] = src_index[n];
+        }
+
+        uint32_t* t;
+        t = src_key; src_key = dst_key; dst_key = t;
+        t = src_index; src_index = dst_index; dst_index = t;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace blib3d::particle
@@ -0,0 +1,63 @@
+#pragma once
+#include "math.hpp"
+#include <cstring>
+
+namespace blib3d::particle
+{
+
+/*
+    particle buffer, structure of arrays
+    arrays are user provided with capacity elements, capacity is a multiple of 4
+    sort_data is scratch for the depth sort, 4 * capacity elements
+*/
+struct buffer
+{
+    uint32_t capacity;
+    uint32_t count;
+
+    float* position[3]; // x y z
+    float* velocity[3]; // x y z, per second
+    float* color[4]; // r g b a, 0..255
+    float* color_speed[4]; // r g b a, per second
+    float* size; // world size
+    float* life; // remaining seconds
+
+    uint32_t* sort_data;
+};
+
+struct particle_data
+{
+    math::vec3 position;
+    math::vec3 velocity;
+    math::vec4 color;
+    math::vec4 color_speed;
+    float size;
+    float life;
+};
+
+// return false if the buffer is full
+bool emit(buffer& b, const particle_data& p);
+
+// integrate velocity, acceleration and color, remove particles with life <= 0
+// particle order is not preserved
+void update(buffer& b, float time_step, const math::vec3 acceleration);
+
+// sort index by key descending, 32 bit radix
+// key and index are count elements, tmp_key and tmp_index are scratch of count elements
+// result is in key and index
+void sort_descending(
+    uint32_t* key,
+    uint32_t* index,
+    uint32_t* tmp_key,
+    uint32_t* tmp_index,
+    uint32_t count);
+
+// unsigned key with the same ordering as float
+inline uint32_t sort_key(float v)
+{
+    uint32_t i;
+    std::memcpy(&i, &v, sizeof(i));
+    return i ^ ((uint32_t)((int32_t)i >> 31) | 0x80000000u);
+}
+
+} // namespace blib3d::particle
@@ -1,35 +1,18 @@
 #include "raster.hpp"
+#include "cpu.hpp"
 #include "raster_interp.hpp"
 #include "raster_fill.hpp"
+#include "raster_span.hpp"
 #include <new>
 #include <cassert>
 #include <cfloat>
+#include <cstring>
 
 namespace blib3d::raster
 {
 
 //------------------------------------------------------------------------------
 
-struct abstract_raster
-{
-    bool is_clockwise;
-
-    virtual bool setup_face(const float* pv[], uint32_t vertex_count) = 0;
-    virtual void process_span(int32_t y, int32_t x0, int32_t x1) = 0;
-};
-
-//------------------------------------------------------------------------------
-
-force_inline int32_t real_to_raster(float v)
-{
-    return math::ceil(v - 0.5f);
-}
-
-force_inline float raster_to_real(int32_t v)
-{
-    return (float)v + 0.5f;
-}
-
 /*
           v0
           *
@@ -47,6 +30,7 @@ force_inline float raster_to_real(int32_t v)
         * error accumulation to make some edges intersect before the endpoint
     but using integer coordinates along with integer line interpolation for edges
     is slower than using float with the x[0] < x[1] check
+    USE_SCAN_FIXED selects the exact version below (3)
 
     (2)
     having surfaces with more than 3 vertices introduced the issue of handling concave shapes
@@ -54,14 +38,15 @@ force_inline float raster_to_real(int32_t v)
     this could cause the scanning loop to not terminate
     to avoid this situation backward tilted edges are treated as horizontal and skipped
 */
-void scan_face(const float* v[], int32_t num_vertices, abstract_raster* r)
+#ifndef USE_SCAN_FIXED
+void scan_face(const real* v[], int32_t num_vertices, abstract_raster* r)
 {
     struct edge
     {
-        float x;
-        float dx_dy;
+        real x;
+        real dx_dy;
 
-        force_inline void setup(const float* v0, const float* v1, float y0)
+        force_inline void setup(const real* v0, const real* v1, real y0)
         {
             dx_dy = (v1[0] - v0[0]) / (v1[1] - v0[1]);
             x = v0[0] + (y0 - v0[1]) * dx_dy;
@@ -162,58 +147,163 @@ void scan_face(const float* v[], int32_t num_vertices, abstract_raster* r)
     }
 }
 
-//------------------------------------------------------------------------------
-
+#else
 /*
-    span fill algorithm
+    (3)
+    vertices are snapped to 28.4 fixed point, each edge is walked top to bottom
+    with an exact integer DDA giving x = ceil(x_edge - 0.5) at pixel centers
+    an edge shared by two faces produces the same x on both, left edge inclusive
+    right edge exclusive, so shared edges are watertight and no pixel is drawn twice
 */
+void scan_face(const real* v[], int32_t num_vertices, abstract_raster* r)
+{
+    static constexpr int32_t subpixel_shift{ 4 };
+    static constexpr int32_t subpixel_one{ 1 << subpixel_shift };
+    static constexpr int32_t subpixel_half{ subpixel_one >> 1 };
+
+    struct edge
+    {
+        int32_t x; // pixel x
+        int32_t r; // error term, x = (n + r) / d
+        int32_t d;
+        int32_t x_step;
+        int32_t r_step;
 
-constexpr int32_t span_block_size{ 16 };
-constexpr int32_t span_block_size_shift{ 4 };
+        force_inline void setup(const int32_t* v0, const int32_t* v1, int32_t y)
+        {
+            int32_t dx{ v1[0] - v0[0] };
+            int32_t dy{ v1[1] - v0[1] };
+            d = dy << subpixel_shift;
+            // n = ((x0 - half) * dy + (yc - y0) * dx), x = ceil(n / d)
+            int64_t n{ (int64_t)(v0[0] - subpixel_half) * dy + (int64_t)((y << subpixel_shift) + subpixel_half - v0[1]) * dx };
+            int64_t q{ n / d };
+            if (q * d < n)
+                ++q;
+            x = (int32_t)q;
+            r = (int32_t)(q * d - n);
+            // per scanline n += dx * one, split in floor quotient and remainder
+            int32_t step{ dx << subpixel_shift };
+            x_step = step / d;
+            r_step = step % d;
+            if (r_step < 0)
+            {
+                r_step += d;
+                --x_step;
+            }
+        }
 
-template<typename raster_type>
-force_inline void span_process_algo(int32_t y, int32_t x0, int32_t x1, raster_type* r)
-{
-    //assert(x0 < x1);
-    typename raster_type::span_data s;
-    r->setup_span(y, x0, s);
-    int32_t n{ x1 - x0 };
-    while (n)
-    {
-        int32_t c{ math::min(n, span_block_size) };
-        n -= c;
-        raster_type::setup_subspan(c, s);
-        while (c--)
-            raster_type::fill(s);
+        force_inline void advance()
+        {
+            x += x_step;
+            r -= r_step;
+            if (r < 0)
+            {
+                r += d;
+                ++x;
+            }
+        }
+    };
+
+    struct util
+    {
+        static force_inline int32_t wrap(int32_t v, int32_t last)
+        {
+            if (v < 0)
+                return last;
+            if (v > last)
+                return 0;
+            return v;
+        };
+
+        static force_inline int32_t to_fixed(real v)
+        {
+            return math::ceil(v * (real)subpixel_one - 0.5f);
+        }
+
+        static force_inline int32_t to_raster(int32_t v)
+        {
+            return (v - subpixel_half + subpixel_one - 1) >> subpixel_shift; // ceil
+        }
+    };
+
+    int32_t fv[num_max_vertices][2];
+    for (int32_t n{ 0 }; n < num_vertices; ++n)
+    {
+        fv[n][0] = util::to_fixed(v[n][0]);
+        fv[n][1] = util::to_fixed(v[n][1]);
     }
-}
 
-//template<typename raster_type>
-//force_inline void span_process_algo(raster_type& raster, int32_t y, int32_t x0, int32_t x1)
-//{
-//    //assert(x0 < x1);
-//    raster.setup_span(y, x0);
-//    while (x0 != x1)
-//    {
-//        int32_t n{ (x0 + span_block_size) & ~(span_block_size - 1) };
-//        int32_t c{ math::min(n, x1) - x0 };
-//        x0 += c;
-//        raster.setup_subspan(c);
-//        while (c--)
-//            raster.fill();
-//    }
-//}
-
-constexpr float subspan_scale[span_block_size]
-{
-           0, 1.f /  1, 1.f /  2, 1.f /  3,
-    1.f /  4, 1.f /  5, 1.f /  6, 1.f /  7,
-    1.f /  8, 1.f /  9, 1.f / 10, 1.f / 11,
-    1.f / 12, 1.f / 13, 1.f / 14, 1.f / 15
-};
+    int32_t vi{ r->is_clockwise ? -1 : 1 }; // vertex index increment
+
+    int32_t vt{ 0 }; // top vertex index
+    int32_t vb{ 0 }; // bottom vertex index
+    for (int32_t n{ 1 }; n < num_vertices; ++n)
+    {
+        if (fv[vt][1] > fv[n][1])
+            vt = n;
+        if (fv[vb][1] < fv[n][1])
+            vb = n;
+    }
+
+    int32_t ylimit[2]
+    {
+        util::to_raster(fv[vt][1]),
+        util::to_raster(fv[vb][1])
+    };
+
+    if (ylimit[0] == ylimit[1])
+        return;
+
+    int32_t last_vertex{ num_vertices - 1 };
+
+    int32_t vl[2]{ vt, util::wrap(vt + vi, last_vertex) }; // left edge vertex indexes
+    int32_t vr[2]{ vt, util::wrap(vt - vi, last_vertex) }; // right edge vertex indexes
+
+    int32_t yl[2]{ ylimit[0], util::to_raster(fv[vl[1]][1]) }; // left edge y
+    int32_t yr[2]{ ylimit[0], util::to_raster(fv[vr[1]][1]) }; // right edge y
+
+    edge e[2]; // e[0] left, e[1] right
 
-static constexpr uint32_t shade_hold{ 4 };
-static constexpr uint32_t shade_mask{ shade_hold - 1 };
+    int32_t y{ ylimit[0] };
+    int32_t yend{ y };
+    for (;;)
+    {
+        if (y == yend)
+        {
+            if (y >= yl[1]) // advance left edge (2)
+            {
+                vl[0] = util::wrap(vl[0] + vi, last_vertex);
+                vl[1] = util::wrap(vl[1] + vi, last_vertex);
+                if (yl[1] == ylimit[1]) // next top is polygon bottom
+                    break;
+                yl[0] = yl[1];
+                yl[1] = util::to_raster(fv[vl[1]][1]);
+                continue;
+            }
+            if (y >= yr[1]) // advance right edge (2)
+            {
+                vr[0] = util::wrap(vr[0] - vi, last_vertex);
+                vr[1] = util::wrap(vr[1] - vi, last_vertex);
+                if (yr[1] == ylimit[1]) // next top is polygon bottom
+                    break;
+                yr[0] = yr[1];
+                yr[1] = util::to_raster(fv[vr[1]][1]);
+                continue;
+            }
+            if (y >= yl[0]) // setup left edge (2)
+                e[0].setup(fv[vl[0]], fv[vl[1]], y);
+            if (y >= yr[0]) // setup right edge (2)
+                e[1].setup(fv[vr[0]], fv[vr[1]], y);
+            yend = yl[1] < yr[1] ? yl[1] : yr[1]; // next nearest end point
+        }
+        if (e[0].x < e[1].x) // empty span
+            r->process_span(y, e[0].x, e[1].x);
+        e[0].advance();
+        e[1].advance();
+        ++y;
+    }
+}
+#endif
 
 //------------------------------------------------------------------------------
 
@@ -222,12 +312,14 @@ struct raster_outline : public abstract_raster
     raster_outline(const config* c)
     {
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         frame_buffer = c->frame_buffer;
     }
 
     // abstract_raster
 
-    bool setup_face(const float* /*pv*/[], uint32_t /*vertex_count*/) override
+    bool setup_face(const real* /*pv*/[], uint32_t /*vertex_count*/) override
     {
         is_clockwise = true;
         return true;
@@ -236,20 +328,22 @@ struct raster_outline : public abstract_raster
     void process_span(int32_t y, int32_t x0, int32_t x1) override
     {
         //assert(x0 < x1);
-        uint32_t* line_addr = reinterpret_cast<uint32_t*>(&frame_buffer[frame_stride * y]);
+        uint32_t* addr = reinterpret_cast<uint32_t*>(frame_buffer);
         int32_t n = x1 - x0;
         if (n == 1)
-            line_addr[x0] = 0xFFFFFF00u;
+            addr[frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step] = 0xFFFFFF00u;
         else if (n > 1)
         {
-            line_addr[x0] = 0xFF00FF00u;
-            line_addr[x1 - 1] = 0xFFFF0000u;
+            addr[frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step] = 0xFF00FF00u;
+            addr[frame_offset(frame_blocked, frame_stride, x1 - 1, y) * pixel_step] = 0xFFFF0000u;
         }
     }
 
     // raster
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     ARGB* frame_buffer;
 };
 
@@ -262,6 +356,8 @@ struct raster_depth : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
     }
 
@@ -269,7 +365,7 @@ struct raster_depth : public abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
@@ -280,47 +376,69 @@ struct raster_depth : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[1];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
 
     struct span_data
     {
-        float gdx;
+        real gdx;
 
-        float attrib;
-        float depth;
+        real attrib;
+        real depth;
 
         float* depth_addr;
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx = g[0].dx;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib = x0f * g[0].dx + y0f * g[0].dy + g[0].d;
 
-        s.depth_addr = &depth_buffer[frame_stride * y + x0];
+        s.depth_addr = &depth_buffer[frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step];
     }
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
         s.depth = s.attrib;
-        s.attrib += s.gdx * (float)count;
+        s.attrib += s.gdx * (real)count;
+    }
+
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
     }
 
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        *s.depth_addr = math::min(*s.depth_addr, s.depth);
+        if (draw)
+            *s.depth_addr = math::depth_min(*s.depth_addr, math::to_float(s.depth));
 
         s.depth += s.gdx;
 
-        s.depth_addr++;
+        s.depth_addr += step;
     }
 };
 
@@ -334,17 +452,27 @@ struct raster_solid_shade_none : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
-        fill_color = reinterpret_cast<const uint32_t&>(c->fill_color);
+        face_fill_color = c->face_fill_color;
+        set_fill_color(c->fill_color);
+    }
+
+    force_inline void set_fill_color(ARGB color)
+    {
+        fill_color = reinterpret_cast<const uint32_t&>(color);
     }
 
     // abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
+        if (face_fill_color)
+            set_fill_color(*face_fill_color++);
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
     }
@@ -354,39 +482,54 @@ struct raster_solid_shade_none : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[1];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
+    const ARGB* face_fill_color;
     uint32_t fill_color;
 
     struct span_data
     {
-        float gdx;
+        real gdx;
 
         uint32_t fill_color;
 
-        float attrib;
-        float depth;
+        real attrib;
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx = g[0].dx;
 
         s.fill_color = fill_color;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib = x0f * g[0].dx + y0f * g[0].dy + g[0].d;
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
     }
@@ -394,12 +537,20 @@ struct raster_solid_shade_none : public abstract_raster
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
         s.depth = s.attrib;
-        s.attrib += s.gdx * (float)count;
+        s.attrib += s.gdx * (real)count;
+    }
+
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
     }
 
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             blend_type::process(s.frame_addr, s.fill_color);
             depth_type::process_write(s.depth_addr, s.depth);
@@ -407,8 +558,8 @@ struct raster_solid_shade_none : public abstract_raster
 
         s.depth += s.gdx;
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
     }
 };
 
@@ -420,20 +571,30 @@ struct raster_solid_shade_vertex : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
-        fill_color[0] = (uint32_t)c->fill_color.a << 24u;
-        fill_color[1] = (uint32_t)c->fill_color.r;
-        fill_color[2] = (uint32_t)c->fill_color.g;
-        fill_color[3] = (uint32_t)c->fill_color.b;
+        face_fill_color = c->face_fill_color;
+        set_fill_color(c->fill_color);
+    }
+
+    force_inline void set_fill_color(ARGB color)
+    {
+        fill_color[0] = (uint32_t)color.a << 24u;
+        fill_color[1] = (uint32_t)color.r;
+        fill_color[2] = (uint32_t)color.g;
+        fill_color[3] = (uint32_t)color.b;
     }
 
     // abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
+        if (face_fill_color)
+            set_fill_color(*face_fill_color++);
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
     }
@@ -443,23 +604,36 @@ struct raster_solid_shade_vertex : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[5];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
+    const ARGB* face_fill_color;
     uint32_t fill_color[4];
 
     struct span_data
     {
-        float gdx[5];
+        real gdx[5];
 
         uint32_t fill_color[4];
 
-        float attrib[5];
-        float depth;
+        real attrib[5];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -468,6 +642,8 @@ struct raster_solid_shade_vertex : public abstract_raster
         int32_t attrib_int_next[3]; // 16.16
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -481,33 +657,33 @@ struct raster_solid_shade_vertex : public abstract_raster
         s.fill_color[2] = fill_color[2];
         s.fill_color[3] = fill_color[3];
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
         s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
         s.attrib[4] = g[4].dx * x0f + g[4].dy * y0f + g[4].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = math::clamp((int32_t)(s.attrib[2] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[1] = math::clamp((int32_t)(s.attrib[3] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
     }
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        s.attrib[4] += s.gdx[4] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int[2] = s.attrib_int_next[2];
@@ -522,16 +698,24 @@ struct raster_solid_shade_vertex : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
-            s.attrib_int_dx[2] = (int32_t)((float)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             uint32_t color
             {
@@ -549,8 +733,8 @@ struct raster_solid_shade_vertex : public abstract_raster
         s.attrib_int[1] += s.attrib_int_dx[1];
         s.attrib_int[2] += s.attrib_int_dx[2];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
     }
 };
 
@@ -562,24 +746,34 @@ struct raster_solid_shade_lightmap : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
-        fill_color[0] = (uint32_t)c->fill_color.a << 24u;
-        fill_color[1] = (uint32_t)c->fill_color.r <<  8u;
-        fill_color[2] = (uint32_t)c->fill_color.g;
-        fill_color[3] = (uint32_t)c->fill_color.b;
+        face_fill_color = c->face_fill_color;
+        set_fill_color(c->fill_color);
         umax = (c->lightmap_width - 1) << 16;
         vmax = (c->lightmap_height - 1) << 16;
         vshift = math::log2(c->lightmap_width);
         lightmap = (const uint32_t*)(c->lightmap);
     }
 
+    force_inline void set_fill_color(ARGB color)
+    {
+        fill_color[0] = (uint32_t)color.a << 24u;
+        fill_color[1] = (uint32_t)color.r <<  8u;
+        fill_color[2] = (uint32_t)color.g;
+        fill_color[3] = (uint32_t)color.b;
+    }
+
     // abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
+        if (face_fill_color)
+            set_fill_color(*face_fill_color++);
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
     }
@@ -589,13 +783,26 @@ struct raster_solid_shade_lightmap : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[4];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
+    const ARGB* face_fill_color;
     uint32_t fill_color[4];
     int32_t umax;
     int32_t vmax;
@@ -604,7 +811,7 @@ struct raster_solid_shade_lightmap : public abstract_raster
 
     struct span_data
     {
-        float gdx[4];
+        real gdx[4];
 
         uint32_t fill_color[4];
         int32_t umax;
@@ -612,8 +819,8 @@ struct raster_solid_shade_lightmap : public abstract_raster
         int32_t vshift;
         const uint32_t* lightmap;
 
-        float attrib[4];
-        float depth;
+        real attrib[4];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -626,6 +833,8 @@ struct raster_solid_shade_lightmap : public abstract_raster
         uint32_t shade[3];
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -642,17 +851,17 @@ struct raster_solid_shade_lightmap : public abstract_raster
         s.vshift = vshift;
         s.lightmap = lightmap;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
         s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = math::clamp((int32_t)(s.attrib[2] * w), (int32_t)0, umax);
         s.attrib_int_next[1] = math::clamp((int32_t)(s.attrib[3] * w), (int32_t)0, vmax);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
 
@@ -662,13 +871,13 @@ struct raster_solid_shade_lightmap : public abstract_raster
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int_next[0] = math::clamp((int32_t)(s.attrib[2] * w), (int32_t)0, s.umax);
@@ -680,15 +889,23 @@ struct raster_solid_shade_lightmap : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             if (((s.shade_counter & shade_mask) == 0) | s.shade_trigger)
             {
@@ -720,8 +937,8 @@ struct raster_solid_shade_lightmap : public abstract_raster
         s.attrib_int[0] += s.attrib_int_dx[0];
         s.attrib_int[1] += s.attrib_int_dx[1];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
 
         s.shade_counter++;
     }
@@ -737,6 +954,8 @@ struct raster_vertex_shade_none : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
     }
@@ -745,7 +964,7 @@ struct raster_vertex_shade_none : public abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
@@ -756,20 +975,32 @@ struct raster_vertex_shade_none : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[6];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
 
     struct span_data
     {
-        float gdx[6];
+        real gdx[6];
 
-        float attrib[6];
-        float depth;
+        real attrib[6];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -778,6 +1009,8 @@ struct raster_vertex_shade_none : public abstract_raster
         int32_t attrib_int_next[4]; // 16.16
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -787,36 +1020,36 @@ struct raster_vertex_shade_none : public abstract_raster
         s.gdx[4] = g[4].dx;
         s.gdx[5] = g[5].dx;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
         s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
         s.attrib[4] = g[4].dx * x0f + g[4].dy * y0f + g[4].d;
         s.attrib[5] = g[5].dx * x0f + g[5].dy * y0f + g[5].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = math::clamp((int32_t)(s.attrib[2] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[1] = math::clamp((int32_t)(s.attrib[3] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, (int32_t)0x00FFFFFF);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
     }
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        s.attrib[4] += s.gdx[4] * count_float;
-        s.attrib[5] += s.gdx[5] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int[2] = s.attrib_int_next[2];
@@ -834,17 +1067,25 @@ struct raster_vertex_shade_none : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
-            s.attrib_int_dx[2] = (int32_t)((float)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
-            s.attrib_int_dx[3] = (int32_t)((float)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             uint32_t color
             {
@@ -863,8 +1104,8 @@ struct raster_vertex_shade_none : public abstract_raster
         s.attrib_int[2] += s.attrib_int_dx[2];
         s.attrib_int[3] += s.attrib_int_dx[3];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
     }
 };
 
@@ -876,6 +1117,8 @@ struct raster_vertex_shade_vertex : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
     }
@@ -884,7 +1127,7 @@ struct raster_vertex_shade_vertex : public abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
@@ -895,20 +1138,32 @@ struct raster_vertex_shade_vertex : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[9];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
 
     struct span_data
     {
-        float gdx[9];
+        real gdx[9];
 
-        float attrib[9];
-        float depth;
+        real attrib[9];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -917,6 +1172,8 @@ struct raster_vertex_shade_vertex : public abstract_raster
         int32_t attrib_int_next[7]; // 16.16
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -929,8 +1186,8 @@ struct raster_vertex_shade_vertex : public abstract_raster
         s.gdx[7] = g[7].dx;
         s.gdx[8] = g[8].dx;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
@@ -940,7 +1197,7 @@ struct raster_vertex_shade_vertex : public abstract_raster
         s.attrib[6] = g[6].dx * x0f + g[6].dy * y0f + g[6].d;
         s.attrib[7] = g[7].dx * x0f + g[7].dy * y0f + g[7].d;
         s.attrib[8] = g[8].dx * x0f + g[8].dy * y0f + g[8].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = math::clamp((int32_t)(s.attrib[2] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[1] = math::clamp((int32_t)(s.attrib[3] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
@@ -949,25 +1206,25 @@ struct raster_vertex_shade_vertex : public abstract_raster
         s.attrib_int_next[5] = math::clamp((int32_t)(s.attrib[7] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[6] = math::clamp((int32_t)(s.attrib[8] * w), (int32_t)0, (int32_t)0x00FFFFFF);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
     }
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        s.attrib[4] += s.gdx[4] * count_float;
-        s.attrib[5] += s.gdx[5] * count_float;
-        s.attrib[6] += s.gdx[6] * count_float;
-        s.attrib[7] += s.gdx[7] * count_float;
-        s.attrib[8] += s.gdx[8] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        s.attrib[6] += s.gdx[6] * count_real;
+        s.attrib[7] += s.gdx[7] * count_real;
+        s.attrib[8] += s.gdx[8] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int[2] = s.attrib_int_next[2];
@@ -994,20 +1251,28 @@ struct raster_vertex_shade_vertex : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
-            s.attrib_int_dx[2] = (int32_t)((float)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
-            s.attrib_int_dx[3] = (int32_t)((float)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
-            s.attrib_int_dx[4] = (int32_t)((float)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
-            s.attrib_int_dx[5] = (int32_t)((float)(s.attrib_int_next[5] - s.attrib_int[5]) * scale);
-            s.attrib_int_dx[6] = (int32_t)((float)(s.attrib_int_next[6] - s.attrib_int[6]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            s.attrib_int_dx[4] = (int32_t)((real)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
+            s.attrib_int_dx[5] = (int32_t)((real)(s.attrib_int_next[5] - s.attrib_int[5]) * scale);
+            s.attrib_int_dx[6] = (int32_t)((real)(s.attrib_int_next[6] - s.attrib_int[6]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             uint32_t color
             {
@@ -1029,8 +1294,8 @@ struct raster_vertex_shade_vertex : public abstract_raster
         s.attrib_int[5] += s.attrib_int_dx[5];
         s.attrib_int[6] += s.attrib_int_dx[6];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
     }
 };
 
@@ -1042,6 +1307,8 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         back_cull = c->back_cull;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
         umax = (c->lightmap_width - 1) << 16;
@@ -1054,7 +1321,7 @@ struct raster_vertex_shade_lightmap : public abstract_raster
 
     bool back_cull;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         return interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g);
@@ -1065,11 +1332,23 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[8];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
     int32_t umax;
@@ -1079,15 +1358,15 @@ struct raster_vertex_shade_lightmap : public abstract_raster
 
     struct span_data
     {
-        float gdx[8];
+        real gdx[8];
 
         int32_t umax;
         int32_t vmax;
         int32_t vshift;
         const uint32_t* lightmap;
 
-        float attrib[8];
-        float depth;
+        real attrib[8];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -1100,6 +1379,8 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         uint32_t shade[3];
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -1116,8 +1397,8 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         s.vshift = vshift;
         s.lightmap = lightmap;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
@@ -1126,7 +1407,7 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         s.attrib[5] = g[5].dx * x0f + g[5].dy * y0f + g[5].d;
         s.attrib[6] = g[6].dx * x0f + g[6].dy * y0f + g[6].d;
         s.attrib[7] = g[7].dx * x0f + g[7].dy * y0f + g[7].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = math::clamp((int32_t)(s.attrib[2] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[1] = math::clamp((int32_t)(s.attrib[3] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
@@ -1134,7 +1415,7 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         s.attrib_int_next[4] = math::clamp((int32_t)(s.attrib[6] * w), (int32_t)0, s.umax);
         s.attrib_int_next[5] = math::clamp((int32_t)(s.attrib[7] * w), (int32_t)0, s.vmax);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
 
@@ -1144,17 +1425,17 @@ struct raster_vertex_shade_lightmap : public abstract_raster
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        s.attrib[4] += s.gdx[4] * count_float;
-        s.attrib[5] += s.gdx[5] * count_float;
-        s.attrib[6] += s.gdx[6] * count_float;
-        s.attrib[7] += s.gdx[7] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        s.attrib[6] += s.gdx[6] * count_real;
+        s.attrib[7] += s.gdx[7] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int[2] = s.attrib_int_next[2];
@@ -1178,19 +1459,27 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
-            s.attrib_int_dx[2] = (int32_t)((float)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
-            s.attrib_int_dx[3] = (int32_t)((float)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
-            s.attrib_int_dx[4] = (int32_t)((float)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
-            s.attrib_int_dx[5] = (int32_t)((float)(s.attrib_int_next[5] - s.attrib_int[5]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            s.attrib_int_dx[4] = (int32_t)((real)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
+            s.attrib_int_dx[5] = (int32_t)((real)(s.attrib_int_next[5] - s.attrib_int[5]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             if (((s.shade_counter & shade_mask) == 0) | s.shade_trigger)
             {
@@ -1226,8 +1515,8 @@ struct raster_vertex_shade_lightmap : public abstract_raster
         s.attrib_int[4] += s.attrib_int_dx[4];
         s.attrib_int[5] += s.attrib_int_dx[5];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
 
         s.shade_counter++;
     }
@@ -1235,78 +1524,6 @@ struct raster_vertex_shade_lightmap : public abstract_raster
 
 //------------------------------------------------------------------------------
 
-int32_t mip_level_calc(const float* v[], uint32_t num_vertices, float texture_width, float texture_height)
-{
-    enum { x, y, zdivw, winv, udivw, vdivw };
-
-    float xy[2][2]; // v0->v1, v0->v2
-    float uv[2][2]; // v0->v1, v0->v2
-    float w0{ 1.f / v[0][winv] };
-    float w1{ 1.f / v[1][winv] };
-    float x0{ v[0][x] };
-    float y0{ v[0][y] };
-    float u0{ v[0][udivw] * w0 };
-    float v0{ v[0][vdivw] * w0 };
-    xy[0][0] = v[1][x] - x0;
-    xy[0][1] = v[1][y] - y0;
-    uv[0][0] = v[1][udivw] * w1 - u0;
-    uv[0][1] = v[1][vdivw] * w1 - v0;
-
-    float a2xy{ 0.f };
-    float a2uv{ 0.f };
-
-    for (uint32_t nv2{ 2 }; nv2 < num_vertices; ++nv2)
-    {
-        float w2{ 1.f / v[nv2][winv] };
-        xy[1][0] = v[nv2][x] - x0;
-        xy[1][1] = v[nv2][y] - y0;
-        uv[1][0] = v[nv2][udivw] * w2 - u0;
-        uv[1][1] = v[nv2][vdivw] * w2 - v0;
-
-        a2xy += math::cross2(xy[0][0], xy[0][1], xy[1][0], xy[1][1]);
-        a2uv += math::cross2(uv[0][0], uv[0][1], uv[1][0], uv[1][1]);
-
-        xy[0][0] = xy[1][0];
-        xy[0][1] = xy[1][1];
-        uv[0][0] = uv[1][0];
-        uv[0][1] = uv[1][1];
-    }
-
-    a2uv *= texture_width * texture_height;
-
-    float l{ math::sqrt(std::abs(a2uv / a2xy)) };
-
-    return math::log2ceil(l);
-}
-
-constexpr int32_t mip_table_max_size{ 16 };
-
-static int32_t mip_table_build(
-    const uint8_t* texture,
-    int32_t texture_width,
-    int32_t texture_height,
-    uint8_t const* mip_table[])
-{
-    int32_t n{ 0 };
-    for (;;)
-    {
-        mip_table[n++] = texture;
-        if (texture_width != 1 && texture_height != 1 && n < mip_table_max_size)
-        {
-            texture += texture_width * texture_height;
-            texture_width >>= 1;
-            texture_height >>= 1;
-        }
-        else
-            break;
-    }
-    for (int32_t i{ n }; i < mip_table_max_size; ++i)
-        mip_table[i] = nullptr;
-    return n;
-}
-
-//------------------------------------------------------------------------------
-
 template<
     typename sample_type = sample_nearest,
     typename blend_type = blend_none,
@@ -1323,6 +1540,8 @@ struct raster_texture_shade_none : public abstract_raster
         texture_height = c->texture_height;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
 
@@ -1352,13 +1571,13 @@ struct raster_texture_shade_none : public abstract_raster
     const uint8_t* mip_table[mip_table_max_size];
     int32_t mip_max_level;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         if (interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g))
         {
-            float texture_width_f{ (float)texture_width };
-            float texture_height_f{ (float)texture_height };
+            real texture_width_f{ (real)texture_width };
+            real texture_height_f{ (real)texture_height };
             if (!mip_enable)
             {
                 g[2].dx *= texture_width_f;
@@ -1374,8 +1593,8 @@ struct raster_texture_shade_none : public abstract_raster
                 mip_level = math::clamp(mip_level, (int32_t)0, mip_max_level);
                 int32_t mip_texture_width{ texture_width >> mip_level };
                 int32_t mip_texture_height{ texture_height >> mip_level };
-                float mip_texture_width_f{ (float)mip_texture_width };
-                float mip_texture_height_f{ (float)mip_texture_height };
+                real mip_texture_width_f{ (real)mip_texture_width };
+                real mip_texture_height_f{ (real)mip_texture_height };
                 g[2].dx *= mip_texture_width_f;
                 g[2].dy *= mip_texture_width_f;
                 g[2].d *= mip_texture_width_f;
@@ -1397,11 +1616,23 @@ struct raster_texture_shade_none : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[4];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
     int32_t smask;
@@ -1412,7 +1643,7 @@ struct raster_texture_shade_none : public abstract_raster
 
     struct span_data
     {
-        float gdx[4];
+        real gdx[4];
 
         int32_t smask;
         int32_t tmask;
@@ -1420,8 +1651,8 @@ struct raster_texture_shade_none : public abstract_raster
         const uint32_t* texture_lut;
         const uint8_t* texture_data;
 
-        float attrib[4];
-        float depth;
+        real attrib[4];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -1430,6 +1661,8 @@ struct raster_texture_shade_none : public abstract_raster
         int32_t attrib_int_next[2]; // 16.16
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -1443,30 +1676,30 @@ struct raster_texture_shade_none : public abstract_raster
         s.texture_lut = texture_lut;
         s.texture_data = texture_data;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
         s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
         s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
     }
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
@@ -1478,15 +1711,23 @@ struct raster_texture_shade_none : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             uint32_t color{ sample_type::process_texel(
                 s.attrib_int[0],
@@ -1503,8 +1744,8 @@ struct raster_texture_shade_none : public abstract_raster
         s.attrib_int[0] += s.attrib_int_dx[0];
         s.attrib_int[1] += s.attrib_int_dx[1];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
     }
 };
 
@@ -1524,6 +1765,8 @@ struct raster_texture_shade_vertex : public abstract_raster
         texture_height = c->texture_height;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
 
@@ -1553,13 +1796,13 @@ struct raster_texture_shade_vertex : public abstract_raster
     const uint8_t* mip_table[mip_table_max_size];
     int32_t mip_max_level;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         if (interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g))
         {
-            float texture_width_f{ (float)texture_width };
-            float texture_height_f{ (float)texture_height };
+            real texture_width_f{ (real)texture_width };
+            real texture_height_f{ (real)texture_height };
             if (!mip_enable)
             {
                 g[2].dx *= texture_width_f;
@@ -1575,8 +1818,8 @@ struct raster_texture_shade_vertex : public abstract_raster
                 mip_level = math::clamp(mip_level, (int32_t)0, mip_max_level);
                 int32_t mip_texture_width{ texture_width >> mip_level };
                 int32_t mip_texture_height{ texture_height >> mip_level };
-                float mip_texture_width_f{ (float)mip_texture_width };
-                float mip_texture_height_f{ (float)mip_texture_height };
+                real mip_texture_width_f{ (real)mip_texture_width };
+                real mip_texture_height_f{ (real)mip_texture_height };
                 g[2].dx *= mip_texture_width_f;
                 g[2].dy *= mip_texture_width_f;
                 g[2].d *= mip_texture_width_f;
@@ -1598,11 +1841,23 @@ struct raster_texture_shade_vertex : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[7];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
     int32_t smask;
@@ -1613,7 +1868,7 @@ struct raster_texture_shade_vertex : public abstract_raster
 
     struct span_data
     {
-        float gdx[7];
+        real gdx[7];
 
         int32_t smask;
         int32_t tmask;
@@ -1621,8 +1876,8 @@ struct raster_texture_shade_vertex : public abstract_raster
         const uint32_t* texture_lut;
         const uint8_t* texture_data;
 
-        float attrib[7];
-        float depth;
+        real attrib[7];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -1631,6 +1886,8 @@ struct raster_texture_shade_vertex : public abstract_raster
         int32_t attrib_int_next[5]; // 16.16
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -1647,8 +1904,8 @@ struct raster_texture_shade_vertex : public abstract_raster
         s.texture_lut = texture_lut;
         s.texture_data = texture_data;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
@@ -1656,30 +1913,30 @@ struct raster_texture_shade_vertex : public abstract_raster
         s.attrib[4] = g[4].dx * x0f + g[4].dy * y0f + g[4].d;
         s.attrib[5] = g[5].dx * x0f + g[5].dy * y0f + g[5].d;
         s.attrib[6] = g[6].dx * x0f + g[6].dy * y0f + g[6].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
         s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
         s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, (int32_t)0x00FFFFFF);
         s.attrib_int_next[4] = math::clamp((int32_t)(s.attrib[6] * w), (int32_t)0, (int32_t)0x00FFFFFF);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
     }
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        s.attrib[4] += s.gdx[4] * count_float;
-        s.attrib[5] += s.gdx[5] * count_float;
-        s.attrib[6] += s.gdx[6] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        s.attrib[6] += s.gdx[6] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int[2] = s.attrib_int_next[2];
@@ -1700,18 +1957,26 @@ struct raster_texture_shade_vertex : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
-            s.attrib_int_dx[2] = (int32_t)((float)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
-            s.attrib_int_dx[3] = (int32_t)((float)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
-            s.attrib_int_dx[4] = (int32_t)((float)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            s.attrib_int_dx[4] = (int32_t)((real)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             uint32_t texel{ sample_type::process_texel(
                 s.attrib_int[0],
@@ -1738,8 +2003,8 @@ struct raster_texture_shade_vertex : public abstract_raster
         s.attrib_int[3] += s.attrib_int_dx[3];
         s.attrib_int[4] += s.attrib_int_dx[4];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
     }
 };
 
@@ -1759,6 +2024,8 @@ struct raster_texture_shade_lightmap : public abstract_raster
         texture_height = c->texture_height;
 
         frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
         depth_buffer = c->depth_buffer;
         frame_buffer = c->frame_buffer;
 
@@ -1793,13 +2060,13 @@ struct raster_texture_shade_lightmap : public abstract_raster
     const uint8_t* mip_table[mip_table_max_size];
     int32_t mip_max_level;
 
-    bool setup_face(const float* pv[], uint32_t vertex_count) override
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
     {
         if (interp_setup_face(pv, vertex_count, back_cull,
             is_clockwise, g))
         {
-            float texture_width_f{ (float)texture_width };
-            float texture_height_f{ (float)texture_height };
+            real texture_width_f{ (real)texture_width };
+            real texture_height_f{ (real)texture_height };
             if (!mip_enable)
             {
                 g[2].dx *= texture_width_f;
@@ -1815,8 +2082,8 @@ struct raster_texture_shade_lightmap : public abstract_raster
                 mip_level = math::clamp(mip_level, (int32_t)0, mip_max_level);
                 int32_t mip_texture_width{ texture_width >> mip_level };
                 int32_t mip_texture_height{ texture_height >> mip_level };
-                float mip_texture_width_f{ (float)mip_texture_width };
-                float mip_texture_height_f{ (float)mip_texture_height };
+                real mip_texture_width_f{ (real)mip_texture_width };
+                real mip_texture_height_f{ (real)mip_texture_height };
                 g[2].dx *= mip_texture_width_f;
                 g[2].dy *= mip_texture_width_f;
                 g[2].d *= mip_texture_width_f;
@@ -1838,11 +2105,23 @@ struct raster_texture_shade_lightmap : public abstract_raster
         span_process_algo(y, x0, x1, this);
     }
 
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
     // raster
 
     gradient g[6];
 
     int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
     ARGB* frame_buffer;
     int32_t smask;
@@ -1857,7 +2136,7 @@ struct raster_texture_shade_lightmap : public abstract_raster
 
     struct span_data
     {
-        float gdx[6];
+        real gdx[6];
 
         int32_t smask;
         int32_t tmask;
@@ -1869,8 +2148,8 @@ struct raster_texture_shade_lightmap : public abstract_raster
         int32_t vshift;
         const uint32_t* lightmap;
 
-        float attrib[6];
-        float depth;
+        real attrib[6];
+        real depth;
 
         float* depth_addr;
         uint32_t* frame_addr;
@@ -1883,6 +2162,8 @@ struct raster_texture_shade_lightmap : public abstract_raster
         uint32_t shade[3];
     };
 
+    span_cursor<span_data> cursor;
+
     force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
     {
         s.gdx[0] = g[0].dx;
@@ -1902,21 +2183,21 @@ struct raster_texture_shade_lightmap : public abstract_raster
         s.vshift = vshift;
         s.lightmap = lightmap;
 
-        float x0f{ raster_to_real(x0) };
-        float y0f{ raster_to_real(y) };
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
         s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
         s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
         s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
         s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
         s.attrib[4] = g[4].dx * x0f + g[4].dy * y0f + g[4].d;
         s.attrib[5] = g[5].dx * x0f + g[5].dy * y0f + g[5].d;
-        float w{ (float)0x10000 / s.attrib[1] };
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
         s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
         s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, s.umax);
         s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, s.vmax);
 
-        int32_t start{ frame_stride * y + x0 };
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
         s.depth_addr = &depth_buffer[start];
         s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
 
@@ -1926,15 +2207,15 @@ struct raster_texture_shade_lightmap : public abstract_raster
 
     force_inline static void setup_subspan(int32_t count, span_data& s)
     {
-        float count_float{ (float)count };
+        real count_real{ (real)count };
         s.depth = s.attrib[0];
-        s.attrib[0] += s.gdx[0] * count_float;
-        s.attrib[1] += s.gdx[1] * count_float;
-        s.attrib[2] += s.gdx[2] * count_float;
-        s.attrib[3] += s.gdx[3] * count_float;
-        s.attrib[4] += s.gdx[4] * count_float;
-        s.attrib[5] += s.gdx[5] * count_float;
-        float w{ (float)0x10000 / s.attrib[1] };
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
         s.attrib_int[0] = s.attrib_int_next[0];
         s.attrib_int[1] = s.attrib_int_next[1];
         s.attrib_int[2] = s.attrib_int_next[2];
@@ -1952,17 +2233,25 @@ struct raster_texture_shade_lightmap : public abstract_raster
         }
         else
         {
-            float scale{ subspan_scale[count] };
-            s.attrib_int_dx[0] = (int32_t)((float)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
-            s.attrib_int_dx[1] = (int32_t)((float)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
-            s.attrib_int_dx[2] = (int32_t)((float)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
-            s.attrib_int_dx[3] = (int32_t)((float)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
         }
     }
 
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
     force_inline static void fill(span_data& s)
     {
-        if (depth_type::process_test(s.depth_addr, s.depth))
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
         {
             uint32_t texel{ sample_type::process_texel(
                 s.attrib_int[0],
@@ -2003,20 +2292,762 @@ struct raster_texture_shade_lightmap : public abstract_raster
         s.attrib_int[2] += s.attrib_int_dx[2];
         s.attrib_int[3] += s.attrib_int_dx[3];
 
-        s.depth_addr++;
-        s.frame_addr++;
+        s.depth_addr += step;
+        s.frame_addr += step;
 
         s.shade_counter++;
     }
 };
 
-//------------------------------------------------------------------------------
-
-void scan_faces(const config* c)
+template<
+    typename sample_type = sample_nearest,
+    typename blend_type = blend_none,
+    typename depth_type = depth_test_write,
+    typename mask_type = mask_texture_off>
+struct raster_texture_shade_vertex_lightmap : public abstract_raster
 {
-    abstract_raster* r{};
-
-    //------------------------------------//
+    raster_texture_shade_vertex_lightmap(const config* c)
+    {
+        back_cull = c->back_cull;
+        mip_enable = (c->flags & MIP_FACE) != 0;
+
+        texture_width = c->texture_width;
+        texture_height = c->texture_height;
+
+        frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
+        depth_buffer = c->depth_buffer;
+        frame_buffer = c->frame_buffer;
+
+        if (!mip_enable)
+        {
+            smask = (c->texture_width - 1) << 16;
+            tmask = (c->texture_height - 1) << 16;
+            tshift = 16 - math::log2(c->texture_width);
+            texture_lut = (uint32_t*)(c->texture_lut);
+            texture_data = c->texture_data;
+        }
+        else
+        {
+            texture_lut = (uint32_t*)(c->texture_lut);
+            mip_max_level = mip_table_build(c->texture_data, c->texture_width, c->texture_height, mip_table) - 1;
+        }
+
+        umax = (c->lightmap_width - 1) << 16;
+        vmax = (c->lightmap_height - 1) << 16;
+        vshift = math::log2(c->lightmap_width);
+        lightmap = (const uint32_t*)(c->lightmap);
+    }
+
+    // abstract_raster
+
+    bool back_cull;
+    bool mip_enable;
+
+    int32_t texture_width;
+    int32_t texture_height;
+
+    const uint8_t* mip_table[mip_table_max_size];
+    int32_t mip_max_level;
+
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
+    {
+        if (interp_setup_face(pv, vertex_count, back_cull,
+            is_clockwise, g))
+        {
+            real texture_width_f{ (real)texture_width };
+            real texture_height_f{ (real)texture_height };
+            if (!mip_enable)
+            {
+                g[2].dx *= texture_width_f;
+                g[2].dy *= texture_width_f;
+                g[2].d *= texture_width_f;
+                g[3].dx *= texture_height_f;
+                g[3].dy *= texture_height_f;
+                g[3].d *= texture_height_f;
+            }
+            else
+            {
+                int32_t mip_level{ mip_level_calc(pv, vertex_count, texture_width_f, texture_height_f) };
+                mip_level = math::clamp(mip_level, (int32_t)0, mip_max_level);
+                int32_t mip_texture_width{ texture_width >> mip_level };
+                int32_t mip_texture_height{ texture_height >> mip_level };
+                real mip_texture_width_f{ (real)mip_texture_width };
+                real mip_texture_height_f{ (real)mip_texture_height };
+                g[2].dx *= mip_texture_width_f;
+                g[2].dy *= mip_texture_width_f;
+                g[2].d *= mip_texture_width_f;
+                g[3].dx *= mip_texture_height_f;
+                g[3].dy *= mip_texture_height_f;
+                g[3].d *= mip_texture_height_f;
+                smask = (mip_texture_width - 1) << 16;
+                tmask = (mip_texture_height - 1) << 16;
+                tshift = 16 - math::log2(mip_texture_width);
+                texture_data = mip_table[mip_level];
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_process_algo(y, x0, x1, this);
+    }
+
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
+    // raster
+
+    gradient g[9];
+
+    int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
+    float* depth_buffer;
+    ARGB* frame_buffer;
+    int32_t smask;
+    int32_t tmask;
+    int32_t tshift;
+    const uint32_t* texture_lut;
+    const uint8_t* texture_data;
+    int32_t umax;
+    int32_t vmax;
+    int32_t vshift;
+    const uint32_t* lightmap;
+
+    struct span_data
+    {
+        real gdx[9];
+
+        int32_t smask;
+        int32_t tmask;
+        int32_t tshift;
+        const uint32_t* texture_lut;
+        const uint8_t* texture_data;
+        int32_t umax;
+        int32_t vmax;
+        int32_t vshift;
+        const uint32_t* lightmap;
+
+        real attrib[9];
+        real depth;
+
+        float* depth_addr;
+        uint32_t* frame_addr;
+        int32_t attrib_int_dx[7]; // 16.16
+        int32_t attrib_int[7]; // 16.16
+        int32_t attrib_int_next[7]; // 16.16
+
+        uint32_t shade_counter;
+        uint32_t shade_trigger;
+        uint32_t shade[3];
+    };
+
+    span_cursor<span_data> cursor;
+
+    force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
+    {
+        s.gdx[0] = g[0].dx;
+        s.gdx[1] = g[1].dx;
+        s.gdx[2] = g[2].dx;
+        s.gdx[3] = g[3].dx;
+        s.gdx[4] = g[4].dx;
+        s.gdx[5] = g[5].dx;
+        s.gdx[6] = g[6].dx;
+        s.gdx[7] = g[7].dx;
+        s.gdx[8] = g[8].dx;
+
+        s.smask = smask;
+        s.tmask = tmask;
+        s.tshift = tshift;
+        s.texture_lut = texture_lut;
+        s.texture_data = texture_data;
+        s.umax = umax;
+        s.vmax = vmax;
+        s.vshift = vshift;
+        s.lightmap = lightmap;
+
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
+        s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
+        s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
+        s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
+        s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
+        s.attrib[4] = g[4].dx * x0f + g[4].dy * y0f + g[4].d;
+        s.attrib[5] = g[5].dx * x0f + g[5].dy * y0f + g[5].d;
+        s.attrib[6] = g[6].dx * x0f + g[6].dy * y0f + g[6].d;
+        s.attrib[7] = g[7].dx * x0f + g[7].dy * y0f + g[7].d;
+        s.attrib[8] = g[8].dx * x0f + g[8].dy * y0f + g[8].d;
+        real w{ (real)0x10000 / s.attrib[1] };
+        s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
+        s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
+        s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[4] = math::clamp((int32_t)(s.attrib[6] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[5] = math::clamp((int32_t)(s.attrib[7] * w), (int32_t)0, s.umax);
+        s.attrib_int_next[6] = math::clamp((int32_t)(s.attrib[8] * w), (int32_t)0, s.vmax);
+
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
+        s.depth_addr = &depth_buffer[start];
+        s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
+
+        s.shade_counter = ((y & 1 ? shade_hold >> 1u : 0u) + x0) & shade_mask;
+        s.shade_trigger = 1;
+    }
+
+    force_inline static void setup_subspan(int32_t count, span_data& s)
+    {
+        real count_real{ (real)count };
+        s.depth = s.attrib[0];
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        s.attrib[6] += s.gdx[6] * count_real;
+        s.attrib[7] += s.gdx[7] * count_real;
+        s.attrib[8] += s.gdx[8] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
+        s.attrib_int[0] = s.attrib_int_next[0];
+        s.attrib_int[1] = s.attrib_int_next[1];
+        s.attrib_int[2] = s.attrib_int_next[2];
+        s.attrib_int[3] = s.attrib_int_next[3];
+        s.attrib_int[4] = s.attrib_int_next[4];
+        s.attrib_int[5] = s.attrib_int_next[5];
+        s.attrib_int[6] = s.attrib_int_next[6];
+        s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
+        s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
+        s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[4] = math::clamp((int32_t)(s.attrib[6] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[5] = math::clamp((int32_t)(s.attrib[7] * w), (int32_t)0, s.umax);
+        s.attrib_int_next[6] = math::clamp((int32_t)(s.attrib[8] * w), (int32_t)0, s.vmax);
+        if (count == span_block_size)
+        {
+            s.attrib_int_dx[0] = (s.attrib_int_next[0] - s.attrib_int[0]) >> span_block_size_shift;
+            s.attrib_int_dx[1] = (s.attrib_int_next[1] - s.attrib_int[1]) >> span_block_size_shift;
+            s.attrib_int_dx[2] = (s.attrib_int_next[2] - s.attrib_int[2]) >> span_block_size_shift;
+            s.attrib_int_dx[3] = (s.attrib_int_next[3] - s.attrib_int[3]) >> span_block_size_shift;
+            s.attrib_int_dx[4] = (s.attrib_int_next[4] - s.attrib_int[4]) >> span_block_size_shift;
+            s.attrib_int_dx[5] = (s.attrib_int_next[5] - s.attrib_int[5]) >> span_block_size_shift;
+            s.attrib_int_dx[6] = (s.attrib_int_next[6] - s.attrib_int[6]) >> span_block_size_shift;
+        }
+        else
+        {
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            s.attrib_int_dx[4] = (int32_t)((real)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
+            s.attrib_int_dx[5] = (int32_t)((real)(s.attrib_int_next[5] - s.attrib_int[5]) * scale);
+            s.attrib_int_dx[6] = (int32_t)((real)(s.attrib_int_next[6] - s.attrib_int[6]) * scale);
+        }
+    }
+
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
+    force_inline static void fill(span_data& s)
+    {
+        if (draw && depth_type::process_test(s.depth_addr, s.depth))
+        {
+            uint32_t texel{ sample_type::process_texel(
+                s.attrib_int[0],
+                s.attrib_int[1],
+                s.smask, s.tmask, s.tshift, s.texture_lut, s.texture_data) };
+            if (mask_type::process(texel))
+            {
+                if (((s.shade_counter & shade_mask) == 0) | s.shade_trigger)
+                {
+                    s.shade_trigger = 0;
+                    uint32_t shade_color{ sample_lightmap(
+                        s.attrib_int[5],
+                        s.attrib_int[6],
+                        s.vshift, s.lightmap) };
+                    uint32_t vertex_color
+                    {
+                        (((uint32_t)s.attrib_int[2] & 0x00FF0000u)       ) +
+                        (((uint32_t)s.attrib_int[3] & 0x00FF0000u) >>  8u) +
+                        (((uint32_t)s.attrib_int[4] & 0x00FF0000u) >> 16u)
+                    };
+                    shade_color = adds_X888(shade_color, vertex_color);
+                    s.shade[0] = (shade_color & 0x00FF0000u) >> 16u;
+                    s.shade[1] = (shade_color & 0x0000FF00u) >>  8u;
+                    s.shade[2] = (shade_color & 0x000000FFu)       ;
+                }
+                uint32_t color
+                {
+                    ((((texel & 0xFF000000u)             )              )      ) +
+                    ((((texel & 0x00FF0000u) * s.shade[0]) & 0xFF000000u) >> 8u) +
+                    ((((texel & 0x0000FF00u) * s.shade[1]) & 0x00FF0000u) >> 8u) +
+                    ((((texel & 0x000000FFu) * s.shade[2])              ) >> 8u)
+                };
+                blend_type::process(s.frame_addr, color);
+                depth_type::process_write(s.depth_addr, s.depth);
+            }
+        }
+        else
+        {
+            s.shade_trigger = 1;
+        }
+
+        s.depth += s.gdx[0];
+        s.attrib_int[0] += s.attrib_int_dx[0];
+        s.attrib_int[1] += s.attrib_int_dx[1];
+        s.attrib_int[2] += s.attrib_int_dx[2];
+        s.attrib_int[3] += s.attrib_int_dx[3];
+        s.attrib_int[4] += s.attrib_int_dx[4];
+        s.attrib_int[5] += s.attrib_int_dx[5];
+        s.attrib_int[6] += s.attrib_int_dx[6];
+
+        s.depth_addr += step;
+        s.frame_addr += step;
+
+        s.shade_counter++;
+    }
+};
+
+//------------------------------------------------------------------------------
+
+/*
+    depth tiles
+    wraps a raster, spans are split at tile boundaries and each piece is
+    compared with the tile min max depth
+        piece nearest depth behind the tile max -> hidden, skipped
+    the visible pieces are drawn as pieces of the whole span (same pixels as
+    without tiles), by raster_write (same raster without depth test) if
+    available and every piece of the span is in front of its tile min
+    after drawing the tile min is lowered, the tile max is lowered only when
+    the piece covers the whole tile and every pixel is written (no mask)
+*/
+struct raster_depth_tile : public abstract_raster
+{
+    raster_depth_tile(const config* c, abstract_raster* r, abstract_raster* r_write)
+    {
+        raster = r;
+        raster_write = r_write;
+        tile = c->depth_tile;
+        tile_stride = c->depth_tile_stride;
+        uint32_t fill{ c->flags & FILL_BIT_MASK };
+        uint32_t blend{ c->flags & BLEND_BIT_MASK };
+        depth_write = fill == FILL_DEPTH || blend == BLEND_NONE || blend == BLEND_MASK;
+        depth_write_all = fill == FILL_DEPTH || (blend == BLEND_NONE && fill != FILL_CUSTOM);
+    }
+
+    abstract_raster* raster;
+    abstract_raster* raster_write;
+    float* tile;
+    int32_t tile_stride;
+    bool depth_write;
+    bool depth_write_all;
+
+    gradient g[1];
+    const real* pv[num_max_vertices];
+    uint32_t vertex_count;
+    bool raster_write_ready;
+
+    bool setup_face(const real* v[], uint32_t count) override
+    {
+        if (!raster->setup_face(v, count))
+            return false;
+        is_clockwise = raster->is_clockwise;
+        interp_setup_face(v, count, false, is_clockwise, g);
+        for (uint32_t nv{ 0 }; nv < count; ++nv)
+            pv[nv] = v[nv];
+        vertex_count = count;
+        raster_write_ready = false;
+        return true;
+    }
+
+    // the span being drawn, the hidden pieces are stepped over by the raster
+    abstract_raster* span_raster;
+    int32_t span_x0;
+    int32_t span_x1;
+    bool span_begun;
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        begin_span(y, x0, x1);
+        process_piece(y, x0, x1);
+    }
+
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_x0 = x0;
+        span_x1 = x1;
+        span_begun = false;
+
+        // raster_write only if every piece of the span is in front of its tile
+        bool write{ raster_write != nullptr };
+        if (write)
+            tile_pieces(y, x0, x1, [&](int32_t, int32_t, bool, float zmin, float zmax, float* t)
+            {
+                write = write && math::depth_less(zmin, t[1]) && math::depth_less(zmax, t[0]);
+            });
+        span_raster = write ? raster_write : raster;
+    }
+
+    void process_piece(int32_t y, int32_t x0, int32_t x1) override
+    {
+        // consecutive visible pieces are drawn as one piece
+        int32_t run_x0{ x0 };
+        bool run{ false };
+        tile_pieces(y, x0, x1, [&](int32_t x, int32_t /*xe*/, bool full, float zmin, float zmax, float* t)
+        {
+            bool visible{ math::depth_less(zmin, t[1]) };
+            if (visible && depth_write)
+            {
+                t[0] = math::depth_min(t[0], zmin);
+                if (depth_write_all && full)
+                    t[1] = math::depth_min(t[1], zmax);
+            }
+            if (visible != run)
+            {
+                if (run)
+                    process_run(y, run_x0, x);
+                run_x0 = x;
+                run = visible;
+            }
+        });
+        if (run)
+            process_run(y, run_x0, x1);
+    }
+
+    void process_run(int32_t y, int32_t x0, int32_t x1)
+    {
+        if (!span_begun)
+        {
+            if (span_raster == raster_write && !raster_write_ready)
+            {
+                raster_write->setup_face(pv, vertex_count);
+                raster_write_ready = true;
+            }
+            if (x0 == span_x0 && x1 == span_x1)
+            {
+                span_raster->process_span(y, x0, x1);
+                return;
+            }
+            span_raster->begin_span(y, span_x0, span_x1);
+            span_begun = true;
+        }
+        span_raster->process_piece(y, x0, x1);
+    }
+
+    // pieces of [x0, x1) split at the tile boundaries with their depth range,
+    // z at the piece start is stepped in real and converted once per piece
+    template<typename piece_func>
+    force_inline void tile_pieces(int32_t y, int32_t x0, int32_t x1, piece_func f)
+    {
+        real dx{ g[0].dx };
+        real dx_tile{ dx * (real)depth_tile_width };
+        real dx_last{ dx * (real)(depth_tile_width - 1) };
+        real z{ dx * raster_to_real(x0) + g[0].dy * raster_to_real(y) + g[0].d };
+        int32_t tx{ x0 >> depth_tile_shift };
+        float* t{ &tile[(tile_stride * y + tx) * 2] };
+        int32_t x{ x0 };
+        while (x < x1)
+        {
+            int32_t tile_x0{ tx << depth_tile_shift };
+            int32_t tile_x1{ tile_x0 + depth_tile_width };
+            int32_t xe{ math::min(tile_x1, x1) };
+            bool full{ x == tile_x0 && xe == tile_x1 };
+            real z0{ z };
+            real z1{ z + (full ? dx_last : dx * (real)(xe - 1 - x)) };
+            z += full ? dx_tile : dx * (real)(xe - x);
+            f(x, xe, full, math::to_float(math::min(z0, z1)), math::to_float(math::max(z0, z1)), t);
+            x = xe;
+            tx++;
+            t += 2;
+        }
+    }
+};
+
+// same raster as scan_faces selects, without depth test, for opaque fills
+abstract_raster* create_raster_depth_write(const config* c, void* raster)
+{
+    switch (c->flags & FILL_BIT_MASK)
+    {
+    case FILL_SOLID:
+        switch (c->flags & (SHADE_BIT_MASK | BLEND_BIT_MASK))
+        {
+        case (SHADE_NONE | BLEND_NONE):
+            return new (raster) raster_solid_shade_none<blend_none, depth_write>(c);
+        case (SHADE_VERTEX | BLEND_NONE):
+            return new (raster) raster_solid_shade_vertex<blend_none, depth_write>(c);
+        case (SHADE_LIGHTMAP | BLEND_NONE):
+            return new (raster) raster_solid_shade_lightmap<blend_none, depth_write>(c);
+        }
+        break;
+    case FILL_VERTEX:
+        switch (c->flags & (SHADE_BIT_MASK | BLEND_BIT_MASK))
+        {
+        case (SHADE_NONE | BLEND_NONE):
+            return new (raster) raster_vertex_shade_none<blend_none, depth_write>(c);
+        case (SHADE_VERTEX | BLEND_NONE):
+            return new (raster) raster_vertex_shade_vertex<blend_none, depth_write>(c);
+        case (SHADE_LIGHTMAP | BLEND_NONE):
+            return new (raster) raster_vertex_shade_lightmap<blend_none, depth_write>(c);
+        }
+        break;
+    case FILL_TEXTURE:
+        switch (c->flags & (SHADE_BIT_MASK | BLEND_BIT_MASK | FILTER_BIT_MASK))
+        {
+        case (SHADE_NONE | BLEND_NONE | FILTER_NONE):
+            return new (raster) raster_texture_shade_none<sample_nearest, blend_none, depth_write>(c);
+        case (SHADE_VERTEX | BLEND_NONE | FILTER_NONE):
+            return new (raster) raster_texture_shade_vertex<sample_nearest, blend_none, depth_write>(c);
+        case (SHADE_LIGHTMAP | BLEND_NONE | FILTER_NONE):
+            return new (raster) raster_texture_shade_lightmap<sample_nearest, blend_none, depth_write>(c);
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_NONE | FILTER_NONE):
+            return new (raster) raster_texture_shade_vertex_lightmap<sample_nearest, blend_none, depth_write>(c);
+        case (SHADE_NONE | BLEND_NONE | FILTER_LINEAR):
+            return new (raster) raster_texture_shade_none<sample_bilinear, blend_none, depth_write>(c);
+        case (SHADE_VERTEX | BLEND_NONE | FILTER_LINEAR):
+            return new (raster) raster_texture_shade_vertex<sample_bilinear, blend_none, depth_write>(c);
+        case (SHADE_LIGHTMAP | BLEND_NONE | FILTER_LINEAR):
+            return new (raster) raster_texture_shade_lightmap<sample_bilinear, blend_none, depth_write>(c);
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_NONE | FILTER_LINEAR):
+            return new (raster) raster_texture_shade_vertex_lightmap<sample_bilinear, blend_none, depth_write>(c);
+        }
+        break;
+    }
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+/*
+    span coverage buffer (s-buffer)
+    wraps a raster, spans are clipped against the covered intervals of the
+    scanline so hidden pixels are never visited, then merged into the list
+    when the list of a scanline is full new spans are drawn but not recorded
+*/
+struct raster_coverage : public abstract_raster
+{
+    raster_coverage(const config* c, abstract_raster* r)
+    {
+        raster = r;
+        spans = c->coverage_spans;
+        count = c->coverage_count;
+        line_capacity = c->coverage_line_capacity;
+    }
+
+    abstract_raster* raster;
+    coverage_span* spans;
+    uint32_t* count;
+    uint32_t line_capacity;
+
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
+    {
+        if (!raster->setup_face(pv, vertex_count))
+            return false;
+        is_clockwise = raster->is_clockwise;
+        return true;
+    }
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        coverage_span* line{ &spans[line_capacity * y] };
+        uint32_t n{ count[y] };
+
+        // the gaps are pieces of the whole span, the pixels are the same as without coverage
+        bool begun{ false };
+        auto draw = [&](int32_t gap_x0, int32_t gap_x1)
+        {
+            if (gap_x0 == x0 && gap_x1 == x1)
+            {
+                raster->process_span(y, x0, x1);
+                return;
+            }
+            if (!begun)
+            {
+                raster->begin_span(y, x0, x1);
+                begun = true;
+            }
+            raster->process_piece(y, gap_x0, gap_x1);
+        };
+
+        // first span touching or after [x0, x1)
+        uint32_t first{ 0 };
+        while (first < n && line[first].x1 < x0)
+            ++first;
+
+        // draw the gaps
+        int32_t x{ x0 };
+        int32_t merged_x0{ x0 };
+        int32_t merged_x1{ x1 };
+        uint32_t last{ first };
+        while (last < n && line[last].x0 <= x1)
+        {
+            if (line[last].x0 > x)
+                draw(x, line[last].x0);
+            x = math::max(x, (int32_t)line[last].x1);
+            merged_x0 = math::min(merged_x0, (int32_t)line[last].x0);
+            merged_x1 = math::max(merged_x1, (int32_t)line[last].x1);
+            ++last;
+        }
+        if (x < x1)
+            draw(x, x1);
+
+        // replace spans [first, last) with the merged one
+        uint32_t removed{ last - first };
+        if (removed == 0)
+        {
+            if (n == line_capacity)
+                return;
+            for (uint32_t i{ n }; i > first; --i)
+                line[i] = line[i - 1];
+            count[y] = n + 1;
+        }
+        else
+        if (removed > 1)
+        {
+            for (uint32_t i{ last }; i < n; ++i)
+                line[i - removed + 1] = line[i];
+            count[y] = n - removed + 1;
+        }
+        line[first].x0 = (int16_t)merged_x0;
+        line[first].x1 = (int16_t)merged_x1;
+    }
+};
+
+//------------------------------------------------------------------------------
+
+/*
+    marks the hierarchical z-buffer cells of the spans drawn by a depth writing raster
+*/
+
+struct raster_occlusion_dirty : public abstract_raster
+{
+    raster_occlusion_dirty(const config* c, abstract_raster* r)
+    {
+        raster = r;
+        occlusion = c->occlusion;
+    }
+
+    abstract_raster* raster;
+    occlusion_data* occlusion;
+
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
+    {
+        if (!raster->setup_face(pv, vertex_count))
+            return false;
+        is_clockwise = raster->is_clockwise;
+        return true;
+    }
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        raster->process_span(y, x0, x1);
+        occlusion_mark_dirty(occlusion, x0, y, x1, y + 1);
+    }
+
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        raster->begin_span(y, x0, x1);
+    }
+
+    void process_piece(int32_t y, int32_t x0, int32_t x1) override
+    {
+        raster->process_piece(y, x0, x1);
+        occlusion_mark_dirty(occlusion, x0, y, x1, y + 1);
+    }
+};
+
+//------------------------------------------------------------------------------
+
+/*
+    clears the flagged tiles of a span before it is drawn
+*/
+
+struct raster_fast_clear : public abstract_raster
+{
+    raster_fast_clear(const config* c, abstract_raster* r)
+    {
+        raster = r;
+        fast_clear = c->fast_clear;
+    }
+
+    abstract_raster* raster;
+    fast_clear_data* fast_clear;
+
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
+    {
+        if (!raster->setup_face(pv, vertex_count))
+            return false;
+        is_clockwise = raster->is_clockwise;
+        return true;
+    }
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        fast_clear_rect(fast_clear, x0, y, x1, y + 1);
+        raster->process_span(y, x0, x1);
+    }
+};
+
+//------------------------------------------------------------------------------
+
+/*
+    clips spans to the frame
+*/
+
+struct raster_scissor : public abstract_raster
+{
+    raster_scissor(const config* c, abstract_raster* r)
+    {
+        raster = r;
+        frame_width = c->frame_width;
+        frame_height = c->frame_height;
+    }
+
+    abstract_raster* raster;
+    int32_t frame_width;
+    int32_t frame_height;
+
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
+    {
+        if (!raster->setup_face(pv, vertex_count))
+            return false;
+        is_clockwise = raster->is_clockwise;
+        return true;
+    }
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        if (y < 0 || y >= frame_height)
+            return;
+        x0 = math::max(x0, (int32_t)0);
+        x1 = math::min(x1, frame_width);
+        if (x0 < x1)
+            raster->process_span(y, x0, x1);
+    }
+};
+
+//------------------------------------------------------------------------------
+
+void scan_faces(const config* c)
+{
+    abstract_raster* r{};
+
+    //------------------------------------//
 
     union raster_pool
     {
@@ -2030,8 +3061,10 @@ void scan_faces(const config* c)
         raster_texture_shade_none<> r7;
         raster_texture_shade_vertex<> r8;
         raster_texture_shade_lightmap<> r9;
+        raster_texture_shade_vertex_lightmap<> r10;
     };
-    alignas(alignof(raster_pool)) uint8_t raster[sizeof(raster_pool)];
+    constexpr size_t raster_size{ sizeof(raster_pool) > custom_raster_max_size ? sizeof(raster_pool) : custom_raster_max_size };
+    alignas(alignof(raster_pool)) uint8_t raster[raster_size];
 
     switch (c->flags & FILL_BIT_MASK)
     {
@@ -2216,8 +3249,42 @@ void scan_faces(const config* c)
         case (SHADE_LIGHTMAP | BLEND_ALPHA | FILTER_LINEAR):
             r = new (raster) raster_texture_shade_lightmap<sample_bilinear, blend_alpha, depth_test>(c);
             break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_NONE | FILTER_NONE):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_nearest>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_MASK | FILTER_NONE):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_nearest, blend_none, depth_test_write, mask_texture_on>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_ADD | FILTER_NONE):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_nearest, blend_add, depth_test>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_MUL | FILTER_NONE):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_nearest, blend_mul, depth_test>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_ALPHA | FILTER_NONE):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_nearest, blend_alpha, depth_test>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_NONE | FILTER_LINEAR):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_bilinear>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_MASK | FILTER_LINEAR):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_bilinear, blend_none, depth_test_write, mask_texture_on>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_ADD | FILTER_LINEAR):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_bilinear, blend_add, depth_test>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_MUL | FILTER_LINEAR):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_bilinear, blend_mul, depth_test>(c);
+            break;
+        case (SHADE_VERTEX_LIGHTMAP | BLEND_ALPHA | FILTER_LINEAR):
+            r = new (raster) raster_texture_shade_vertex_lightmap<sample_bilinear, blend_alpha, depth_test>(c);
+            break;
         }
         break;
+    case FILL_CUSTOM:
+        if (c->custom_raster != nullptr)
+            r = c->custom_raster(c, raster);
+        break;
     }
 
     //------------------------------------//
@@ -2225,16 +3292,45 @@ void scan_faces(const config* c)
     if (r == nullptr)
         return;
 
+    alignas(alignof(raster_pool)) uint8_t write_raster[sizeof(raster_pool)];
+    alignas(alignof(raster_depth_tile)) uint8_t depth_tile_raster[sizeof(raster_depth_tile)];
+    if (c->depth_tile != nullptr && (c->flags & FILL_BIT_MASK) != FILL_OUTLINE)
+        r = new (depth_tile_raster) raster_depth_tile(c, r, create_raster_depth_write(c, write_raster));
+
+    alignas(alignof(raster_occlusion_dirty)) uint8_t occlusion_raster[sizeof(raster_occlusion_dirty)];
+    if (c->occlusion != nullptr && c->occlusion->dirty != nullptr &&
+        (c->flags & FILL_BIT_MASK) != FILL_OUTLINE &&
+        ((c->flags & FILL_BIT_MASK) == FILL_DEPTH ||
+         (c->flags & BLEND_BIT_MASK) == BLEND_NONE ||
+         (c->flags & BLEND_BIT_MASK) == BLEND_MASK))
+        r = new (occlusion_raster) raster_occlusion_dirty(c, r);
+
+    // opaque fills only, masked or blended faces do not hide what is behind
+    alignas(alignof(raster_coverage)) uint8_t coverage_raster[sizeof(raster_coverage)];
+    if (c->coverage_spans != nullptr &&
+        (c->flags & BLEND_BIT_MASK) == BLEND_NONE &&
+        (c->flags & FILL_BIT_MASK) != FILL_OUTLINE &&
+        (c->flags & FILL_BIT_MASK) != FILL_CUSTOM)
+        r = new (coverage_raster) raster_coverage(c, r);
+
+    alignas(alignof(raster_fast_clear)) uint8_t fast_clear_raster[sizeof(raster_fast_clear)];
+    if (c->fast_clear != nullptr)
+        r = new (fast_clear_raster) raster_fast_clear(c, r);
+
+    alignas(alignof(raster_scissor)) uint8_t scissor_raster[sizeof(raster_scissor)];
+    if (c->scissor)
+        r = new (scissor_raster) raster_scissor(c, r);
+
     uint32_t num_faces{ c->num_faces };
     const uint32_t* num_vertices{ c->vertex_count_data };
-    const float* vertex_data{ c->vertex_data };
+    const real* vertex_data{ c->vertex_data };
     uint32_t vertex_stride{ c->vertex_stride };
 
     while (num_faces--)
     {
         uint32_t vertex_count{ *num_vertices++ };
 
-        const float* pv[num_max_vertices];
+        const real* pv[num_max_vertices];
         for (uint32_t nv{}; nv < vertex_count; ++nv)
         {
             pv[nv] = vertex_data;
@@ -2248,6 +3344,213 @@ void scan_faces(const config* c)
 
 //------------------------------------------------------------------------------
 
+void frame_fill_rect(bool blocked, int32_t stride, int32_t step, uint32_t* buffer,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t value, bool stream)
+{
+    if (step != 1)
+    {
+        // interleaved, every step-th word
+        for (int32_t y{ y0 }; y < y1; ++y)
+        {
+            frame_row_pieces(blocked, stride, x0, x1, y, [&](int32_t offset, int32_t /*x*/, int32_t count)
+            {
+                uint32_t* p{ &buffer[offset * step] };
+                for (int32_t n{ 0 }; n < count; ++n, p += step)
+                    *p = value;
+            });
+        }
+        return;
+    }
+
+    auto fill{ stream ? cpu::kernels.fill_stream : cpu::kernels.fill };
+    if (blocked &&
+        ((x0 | x1) & (frame_block_width - 1)) == 0 &&
+        ((y0 | y1) & (frame_block_height - 1)) == 0)
+    {
+        // the blocks of a block row are contiguous
+        for (int32_t y{ y0 }; y < y1; y += frame_block_height)
+            fill(&buffer[frame_offset(true, stride, x0, y)], value, (uint32_t)((x1 - x0) * frame_block_height));
+        return;
+    }
+    for (int32_t y{ y0 }; y < y1; ++y)
+    {
+        frame_row_pieces(blocked, stride, x0, x1, y, [&](int32_t offset, int32_t /*x*/, int32_t count)
+        {
+            fill(&buffer[offset], value, (uint32_t)count);
+        });
+    }
+}
+
+void frame_fill_rect_interleaved(bool blocked, int32_t stride, depth_ARGB* buffer,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t depth, uint32_t color)
+{
+    depth_ARGB value;
+    std::memcpy(&value.depth, &depth, sizeof(depth));
+    std::memcpy(&value.color, &color, sizeof(color));
+    for (int32_t y{ y0 }; y < y1; ++y)
+    {
+        frame_row_pieces(blocked, stride, x0, x1, y, [&](int32_t offset, int32_t /*x*/, int32_t count)
+        {
+            depth_ARGB* p{ &buffer[offset] };
+            for (int32_t n{ 0 }; n < count; ++n)
+                p[n] = value;
+        });
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// fill the rows of the tile runs flagged with all bits, whole blocks in the blocked layout,
+// the tiles at the frame edge are padded to whole blocks
+static void fast_clear_bits(fast_clear_data& data, uint8_t* flags, int32_t tx0, int32_t tx1, int32_t ty, uint32_t bits)
+{
+    int32_t y0{ ty << fast_clear_tile_shift };
+    int32_t y1{ math::min(y0 + (1 << fast_clear_tile_shift), data.frame_height) };
+    if (data.frame_blocked)
+        y1 = (y1 + frame_block_height - 1) & ~(frame_block_height - 1);
+    int32_t tx{ tx0 };
+    while (tx < tx1)
+    {
+        if ((flags[tx] & bits) != bits)
+        {
+            ++tx;
+            continue;
+        }
+        int32_t run_end{ tx + 1 };
+        while (run_end < tx1 && (flags[run_end] & bits) == bits)
+            ++run_end;
+        int32_t x0{ tx << fast_clear_tile_shift };
+        int32_t x1{ math::min(run_end << fast_clear_tile_shift, data.frame_width) };
+        if (data.frame_blocked)
+            x1 = (x1 + frame_block_width - 1) & ~(frame_block_width - 1);
+        if (bits == (FAST_CLEAR_FRAME | FAST_CLEAR_DEPTH))
+            frame_fill_rect_interleaved(data.frame_blocked, data.frame_stride,
+                reinterpret_cast<depth_ARGB*>(data.depth_buffer), x0, y0, x1, y1, data.depth, data.color);
+        else
+        if (bits == FAST_CLEAR_FRAME)
+            frame_fill_rect(data.frame_blocked, data.frame_stride, data.pixel_step,
+                reinterpret_cast<uint32_t*>(data.frame_buffer), x0, y0, x1, y1, data.color, false);
+        else
+            frame_fill_rect(data.frame_blocked, data.frame_stride, data.pixel_step,
+                reinterpret_cast<uint32_t*>(data.depth_buffer), x0, y0, x1, y1, data.depth, false);
+        for (; tx < run_end; ++tx)
+            flags[tx] = (uint8_t)(flags[tx] & ~bits);
+    }
+}
+
+void fast_clear_tiles(fast_clear_data& data, int32_t tx0, int32_t tx1, int32_t ty, uint32_t mask)
+{
+    uint8_t* flags{ &data.flags[data.tile_w * ty] };
+    // interleaved pixels, tiles with both flags in one pass
+    if (data.pixel_step == 2 && mask == (FAST_CLEAR_FRAME | FAST_CLEAR_DEPTH))
+        fast_clear_bits(data, flags, tx0, tx1, ty, mask);
+    if (mask & FAST_CLEAR_FRAME)
+        fast_clear_bits(data, flags, tx0, tx1, ty, FAST_CLEAR_FRAME);
+    if (mask & FAST_CLEAR_DEPTH)
+        fast_clear_bits(data, flags, tx0, tx1, ty, FAST_CLEAR_DEPTH);
+}
+
+void fast_clear_resolve(fast_clear_data& data, uint32_t mask)
+{
+    if ((data.pending & mask) == 0)
+        return;
+    for (int32_t ty{ 0 }; ty < data.tile_h; ++ty)
+        fast_clear_tiles(data, 0, data.tile_w, ty, mask);
+    data.pending &= ~mask;
+}
+
+//------------------------------------------------------------------------------
+
+// level entries [x0, x1) x [y0, y1) from the 2x2 blocks of the finer level
+template<bool use_min>
+static void occlusion_reduce(
+    occlusion_data::level& lo,
+    const occlusion_data::level& hi,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    x1 = math::min(x1, lo.w);
+    y1 = math::min(y1, lo.h);
+    int32_t x_full = math::max(x0, math::min(x1, hi.w >> 1)); // end of the full 2x2 blocks
+    for (int32_t y = y0; y < y1; ++y)
+    {
+        int32_t y_hi0 = y << 1;
+        int32_t y_hi1 = math::min(y_hi0 + 2, hi.h);
+        int32_t x = x0;
+        if (y_hi1 - y_hi0 == 2 && x < x_full)
+        {
+            const float* row0 = &hi.depth[hi.w * y_hi0 + (x << 1)];
+            const float* row1 = row0 + hi.w;
+            if (use_min)
+                cpu::kernels.reduce_min(&lo.depth[x + lo.w * y], row0, row1, x_full - x);
+            else
+                cpu::kernels.reduce_max(&lo.depth[x + lo.w * y], row0, row1, x_full - x);
+            x = x_full;
+        }
+        for (; x < x1; ++x)
+        {
+            int32_t x_hi0 = x << 1;
+            int32_t x_hi1 = math::min(x_hi0 + 2, hi.w);
+            float d = use_min ? +FLT_MAX : -FLT_MAX;
+            for (int32_t y_hi = y_hi0; y_hi < y_hi1; ++y_hi)
+                for (int32_t x_hi = x_hi0; x_hi < x_hi1; ++x_hi)
+                    d = use_min ? math::depth_min(d, hi.depth[x_hi + hi.w * y_hi]) : math::depth_max(d, hi.depth[x_hi + hi.w * y_hi]);
+            lo.depth[x + lo.w * y] = d;
+        }
+    }
+}
+
+// level 0 entries [x0, x1) x [y0, y1) from the 2x2 pixel blocks of the depth buffer
+static void occlusion_reduce_frame(
+    occlusion_data::level& lo,
+    const occlusion_config& cfg,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    if (!cfg.frame_blocked && cfg.frame_stride == cfg.frame_width && cfg.pixel_step == 1)
+    {
+        occlusion_data::level frame{ cfg.depth_buffer, cfg.frame_width, cfg.frame_height };
+        occlusion_reduce<true>(lo, frame, x0, y0, x1, y1);
+        return;
+    }
+
+    // pixel rows 2y and 2y + 1 are in the same block row, 8 entries per block,
+    // interleaved pixels are reduced one by one
+    auto depth = [&](int32_t x, int32_t y) -> const float*
+    {
+        return &cfg.depth_buffer[frame_offset(cfg.frame_blocked, cfg.frame_stride, x, y) * cfg.pixel_step];
+    };
+    int32_t row_step = cfg.frame_blocked ? frame_block_width : cfg.frame_stride;
+    int32_t piece = cfg.frame_blocked ? frame_block_width >> 1 : INT32_MAX;
+    x1 = math::min(x1, lo.w);
+    y1 = math::min(y1, lo.h);
+    int32_t x_full = math::max(x0, math::min(x1, cfg.frame_width >> 1)); // end of the full 2x2 blocks
+    for (int32_t y = y0; y < y1; ++y)
+    {
+        int32_t y_hi0 = y << 1;
+        int32_t y_hi1 = math::min(y_hi0 + 2, cfg.frame_height);
+        int32_t x = x0;
+        if (y_hi1 - y_hi0 == 2 && cfg.pixel_step == 1)
+        {
+            while (x < x_full)
+            {
+                int32_t c = math::min(x_full - x, piece - x % piece);
+                const float* row0 = depth(x << 1, y_hi0);
+                cpu::kernels.reduce_min(&lo.depth[x + lo.w * y], row0, row0 + row_step, c);
+                x += c;
+            }
+        }
+        for (; x < x1; ++x)
+        {
+            int32_t x_hi0 = x << 1;
+            int32_t x_hi1 = math::min(x_hi0 + 2, cfg.frame_width);
+            float d = +FLT_MAX;
+            for (int32_t y_hi = y_hi0; y_hi < y_hi1; ++y_hi)
+                for (int32_t x_hi = x_hi0; x_hi < x_hi1; ++x_hi)
+                    d = math::depth_min(d, *depth(x_hi, y_hi));
+            lo.depth[x + lo.w * y] = d;
+        }
+    }
+}
+
 void occlusion_build_mipchain(occlusion_config& cfg, occlusion_data& data)
 {
     uint32_t depth_hi_w;
@@ -2262,7 +3565,8 @@ void occlusion_build_mipchain(occlusion_config& cfg, occlusion_data& data)
     pdepth_hi = cfg.depth_buffer;
     depth_lo_w = (depth_hi_w + 1) >> 1;
     depth_lo_h = (depth_hi_h + 1) >> 1;
-    pdepth_lo = pdepth_hi + depth_hi_w * depth_hi_h;
+    uint32_t frame_rows = cfg.frame_blocked ? (depth_hi_h + frame_block_height - 1) & ~(frame_block_height - 1) : depth_hi_h;
+    pdepth_lo = pdepth_hi + cfg.frame_stride * frame_rows * cfg.pixel_step;
 
     data.level_count = 0;
 
@@ -2271,28 +3575,8 @@ void occlusion_build_mipchain(occlusion_config& cfg, occlusion_data& data)
     // use min to ignore 1 pixel cracks
     assert(data.level_count < data.level_max_count);
     {
-        {
-            uint32_t count = depth_lo_w * depth_lo_h;
-            float* pdepth = pdepth_lo;
-            while (count--)
-                *pdepth++ = +FLT_MAX;
-        }
-
-        for (uint32_t y_hi = 0; y_hi < depth_hi_h; ++y_hi)
-        {
-            uint32_t index_row_hi = depth_hi_w * y_hi;
-            uint32_t index_row_lo = depth_lo_w * (y_hi >> 1);
-            for (uint32_t x_hi = 0; x_hi < depth_hi_w; ++x_hi)
-            {
-                uint32_t index_hi = index_row_hi + x_hi;
-                uint32_t index_lo = index_row_lo + (x_hi >> 1);
-                assert(index_hi >= 0);
-                assert(index_hi < depth_hi_w* depth_hi_h);
-                assert(index_lo >= 0);
-                assert(index_lo < depth_lo_w* depth_lo_h);
-                pdepth_lo[index_lo] = math::min(pdepth_lo[index_lo], pdepth_hi[index_hi]);
-            }
-        }
+        occlusion_data::level lo{ pdepth_lo, (int32_t)depth_lo_w, (int32_t)depth_lo_h };
+        occlusion_reduce_frame(lo, cfg, 0, 0, lo.w, lo.h);
 
         uint32_t level = data.level_count;
         data.levels[level].depth = pdepth_lo;
@@ -2312,28 +3596,9 @@ void occlusion_build_mipchain(occlusion_config& cfg, occlusion_data& data)
     // other levels, use max
     while ((depth_lo_w != 1 || depth_lo_h != 1) && data.level_count < data.level_max_count)
     {
-        {
-            uint32_t count = depth_lo_w * depth_lo_h;
-            float* pdepth = pdepth_lo;
-            while (count--)
-                *pdepth++ = -FLT_MAX;
-        }
-
-        for (uint32_t y_hi = 0; y_hi < depth_hi_h; ++y_hi)
-        {
-            uint32_t index_row_hi = depth_hi_w * y_hi;
-            uint32_t index_row_lo = depth_lo_w * (y_hi >> 1);
-            for (uint32_t x_hi = 0; x_hi < depth_hi_w; ++x_hi)
-            {
-                uint32_t index_hi = index_row_hi + x_hi;
-                uint32_t index_lo = index_row_lo + (x_hi >> 1);
-                assert(index_hi >= 0);
-                assert(index_hi < depth_hi_w* depth_hi_h);
-                assert(index_lo >= 0);
-                assert(index_lo < depth_lo_w* depth_lo_h);
-                pdepth_lo[index_lo] = math::max(pdepth_lo[index_lo], pdepth_hi[index_hi]);
-            }
-        }
+        occlusion_data::level hi{ pdepth_hi, (int32_t)depth_hi_w, (int32_t)depth_hi_h };
+        occlusion_data::level lo{ pdepth_lo, (int32_t)depth_lo_w, (int32_t)depth_lo_h };
+        occlusion_reduce<false>(lo, hi, 0, 0, lo.w, lo.h);
 
         uint32_t level = data.level_count;
         data.levels[level].depth = pdepth_lo;
@@ -2348,6 +3613,67 @@ void occlusion_build_mipchain(occlusion_config& cfg, occlusion_data& data)
         depth_lo_h = (depth_hi_h + 1) >> 1;
         pdepth_lo = pdepth_hi + depth_hi_w * depth_hi_h;
     }
+
+    // dirty cells after the last level
+    data.dirty = nullptr;
+    if (data.level_count > occlusion_cell_level)
+    {
+        occlusion_data::level& cl = data.levels[occlusion_cell_level];
+        data.dirty = reinterpret_cast<uint8_t*>(pdepth_lo);
+        uint32_t count = cl.w * cl.h;
+        uint8_t* pdirty = data.dirty;
+        while (count--)
+            *pdirty++ = 0;
+    }
+    data.dirty_rect[0] = INT32_MAX;
+    data.dirty_rect[1] = INT32_MAX;
+    data.dirty_rect[2] = 0;
+    data.dirty_rect[3] = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void occlusion_update_mipchain(occlusion_config& cfg, occlusion_data& data)
+{
+    int32_t* rect = data.dirty_rect;
+    if (data.dirty == nullptr || rect[0] >= rect[2])
+        return;
+
+    // cells, levels up to the cell level from the depth buffer
+    occlusion_data::level* levels = data.levels;
+    int32_t cell_w = levels[occlusion_cell_level].w;
+    for (int32_t cy = rect[1]; cy < rect[3]; ++cy)
+    {
+        for (int32_t cx = rect[0]; cx < rect[2]; ++cx)
+        {
+            uint8_t& dirty = data.dirty[cx + cell_w * cy];
+            if (!dirty)
+                continue;
+            dirty = 0;
+            occlusion_reduce_frame(levels[0], cfg, cx << 2, cy << 2, (cx + 1) << 2, (cy + 1) << 2);
+            occlusion_reduce<false>(levels[1], levels[0], cx << 1, cy << 1, (cx + 1) << 1, (cy + 1) << 1);
+            occlusion_reduce<false>(levels[2], levels[1], cx, cy, cx + 1, cy + 1);
+        }
+    }
+
+    // coarser levels over the dirty rect
+    int32_t x0 = rect[0];
+    int32_t y0 = rect[1];
+    int32_t x1 = rect[2];
+    int32_t y1 = rect[3];
+    for (uint32_t level = occlusion_cell_level + 1; level < data.level_count; ++level)
+    {
+        x0 >>= 1;
+        y0 >>= 1;
+        x1 = ((x1 - 1) >> 1) + 1;
+        y1 = ((y1 - 1) >> 1) + 1;
+        occlusion_reduce<false>(levels[level], levels[level - 1], x0, y0, x1, y1);
+    }
+
+    rect[0] = INT32_MAX;
+    rect[1] = INT32_MAX;
+    rect[2] = 0;
+    rect[3] = 0;
 }
 
 bool occlusion_test_rect(
@@ -2355,8 +3681,8 @@ bool occlusion_test_rect(
     occlusion_data& data,
     float screen_min[2], float screen_max[2], float depth_min)
 {
-    int32_t rect_min[2]{ real_to_raster(screen_min[0]), real_to_raster(screen_min[1]) };
-    int32_t rect_max[2]{ real_to_raster(screen_max[0]), real_to_raster(screen_max[1]) };
+    int32_t rect_min[2]{ real_to_raster(math::to_real(screen_min[0])), real_to_raster(math::to_real(screen_min[1])) };
+    int32_t rect_max[2]{ real_to_raster(math::to_real(screen_max[0])), real_to_raster(math::to_real(screen_max[1])) };
     if (rect_min[0] == rect_max[0])
         return true;
     if (rect_min[1] == rect_max[1])
@@ -2403,10 +3729,10 @@ bool occlusion_test_rect(
         {
             assert(x >= 0);
             assert(x < ol.w);
-            depth_max = math::max(depth_max, ol.depth[x + ol.w * y]);
+            depth_max = math::depth_max(depth_max, ol.depth[x + ol.w * y]);
         }
     }
-    return depth_min > depth_max;
+    return math::depth_less(depth_max, depth_min);
 }
 
 //------------------------------------------------------------------------------
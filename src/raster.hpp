@@ -4,6 +4,8 @@
 namespace blib3d::raster
 {
 
+using math::real;
+
 //------------------------------------------------------------------------------
 
 static constexpr uint32_t num_max_vertices{ 12 };
@@ -39,10 +41,12 @@ enum
     FILL_SOLID      = 2,
     FILL_VERTEX     = 3,
     FILL_TEXTURE    = 4,
+    FILL_CUSTOM     = 5,
 
     SHADE_NONE      = 0 << SHADE_SHIFT,
     SHADE_VERTEX    = 1 << SHADE_SHIFT,
     SHADE_LIGHTMAP  = 2 << SHADE_SHIFT,
+    SHADE_VERTEX_LIGHTMAP = 3 << SHADE_SHIFT, // FILL_TEXTURE only
 
     BLEND_NONE      = 0 << BLEND_SHIFT,
     BLEND_MASK      = 1 << BLEND_SHIFT,
@@ -58,23 +62,114 @@ enum
     FILTER_LINEAR   = 1 << FILTER_SHIFT,
 };
 
+struct abstract_raster;
+struct config;
+struct occlusion_data;
+struct fast_clear_data;
+
+// depth tile, min max depth of a scanline segment
+static constexpr int32_t depth_tile_width{ 16 };
+static constexpr int32_t depth_tile_shift{ 4 };
+
+// blocked frame layout, color and depth in 16x4 pixel blocks, the 16 pixel rows of a
+// block follow each other and the blocks of a block row follow each other,
+// frame_stride is a multiple of 16 and the buffers hold whole block rows
+static constexpr int32_t frame_block_width{ 16 };
+static constexpr int32_t frame_block_height{ 4 };
+
+// offset of pixel x y in a linear or blocked frame
+force_inline int32_t frame_offset(bool blocked, int32_t stride, int32_t x, int32_t y)
+{
+    if (!blocked)
+        return stride * y + x;
+    return
+        (y & ~(frame_block_height - 1)) * stride + (x & ~(frame_block_width - 1)) * frame_block_height +
+        (y & (frame_block_height - 1)) * frame_block_width + (x & (frame_block_width - 1));
+}
+
+// interleaved frame pixel, depth and color in one buffer, depth_buffer and frame_buffer
+// point to the first pixel members and pixel_step is 2
+struct depth_ARGB
+{
+    float depth;
+    ARGB color;
+};
+
+// f(offset, x, count) for the contiguous pieces of the pixels [x0, x1) of row y
+template<typename func_type>
+force_inline void frame_row_pieces(bool blocked, int32_t stride, int32_t x0, int32_t x1, int32_t y, func_type f)
+{
+    while (x0 < x1)
+    {
+        int32_t x{ blocked ? math::min(x1, (x0 | (frame_block_width - 1)) + 1) : x1 };
+        f(frame_offset(blocked, stride, x0, y), x0, x - x0);
+        x0 = x;
+    }
+}
+
+// fill the pixels [x0, x1) x [y0, y1), one fill per block row for rects of whole blocks
+// step is the pixel_step, stream uses non-temporal stores
+void frame_fill_rect(bool blocked, int32_t stride, int32_t step, uint32_t* buffer,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t value, bool stream);
+
+// fill depth and color of the depth_ARGB pixels [x0, x1) x [y0, y1), 32 bit patterns
+void frame_fill_rect_interleaved(bool blocked, int32_t stride, depth_ARGB* buffer,
+    int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t depth, uint32_t color);
+
+// covered interval [x0, x1) of a scanline
+struct coverage_span
+{
+    int16_t x0;
+    int16_t x1;
+};
+
+// construct a raster in storage, storage size is custom_raster_max_size
+// see raster_custom.hpp
+using custom_raster_factory = abstract_raster* (*)(const config* c, void* storage);
+static constexpr uint32_t custom_raster_max_size{ 512 };
+
 struct config
 {
     uint32_t flags;
 
     uint32_t num_faces;
     uint32_t* vertex_count_data;
-    const float* vertex_data;
+    const real* vertex_data;
     uint32_t vertex_stride;
 
     bool back_cull;
 
+    int32_t frame_width;
+    int32_t frame_height;
     int32_t frame_stride;
+    bool frame_blocked; // see frame_offset
+    int32_t pixel_step; // 32 bit words per pixel, 1 or 2 for depth_ARGB pixels
     float* depth_buffer;
     ARGB* frame_buffer;
 
+    // clip spans to the frame, for faces that extend outside of it (tile binning)
+    bool scissor;
+
+    // span coverage (s-buffer), sorted disjoint spans per scanline, nullptr if not used
+    // BLEND_NONE faces skip covered pixels and add their spans, faces must come front to back
+    coverage_span* coverage_spans; // frame height * coverage_line_capacity
+    uint32_t* coverage_count; // frame height
+    uint32_t coverage_line_capacity;
+
+    // depth tiles, conservative min max depth per depth_tile_width pixels of a scanline, nullptr if not used
+    // spans behind a tile are skipped, spans in front of a tile are drawn without depth test
+    float* depth_tile; // frame height * depth_tile_stride * 2
+    int32_t depth_tile_stride;
+
+    // hierarchical z-buffer, depth writes mark the mipchain cells to update, nullptr if not used
+    occlusion_data* occlusion;
+
+    // lazy clear, spans clear the flagged tiles they touch before drawing, nullptr if not used
+    fast_clear_data* fast_clear;
+
     ARGB fill_color;
     ARGB shade_color;
+    const ARGB* face_fill_color; // FILL_SOLID per face color, nullptr to use fill_color
 
     int32_t texture_width;
     int32_t texture_height;
@@ -84,20 +179,101 @@ struct config
     int32_t lightmap_width;
     int32_t lightmap_height;
     const ARGB* lightmap;
+
+    custom_raster_factory custom_raster;
 };
 
 void scan_faces(const config* c);
 
 //------------------------------------------------------------------------------
 
-struct occlusion_config
+/*
+    screen aligned rect at constant depth, affine texture mapping
+    FILL_SOLID draws color
+    FILL_TEXTURE draws texture rect, SHADE_VERTEX modulates it by color
+*/
+struct sprite
+{
+    real x0, y0, x1, y1; // screen rect
+    real depth;
+    real s0, t0, s1, t1; // texture rect
+    ARGB color;
+};
+
+void scan_sprites(const config* c, const sprite* sprites, uint32_t count);
+
+/*
+    color and depth image drawn scaled to the sprite rect, nearest sampling
+    the texture rect selects the image region, image pixels at depth FLT_MAX are empty,
+    the others are depth tested and written at image depth + sprite depth
+*/
+struct depth_image
 {
+    int32_t width;
+    int32_t height;
+    const ARGB* color; // width * height
+    const float* depth; // width * height
+};
+
+void scan_depth_image(const config* c, const depth_image& image, const sprite& sp);
+
+//------------------------------------------------------------------------------
+
+/*
+    lazy clear, a clear flags the tiles instead of writing the buffers
+    faces and sprites clear a flagged tile when they first touch it,
+    fast_clear_resolve clears the tiles that were not drawn
+*/
+
+// fast clear tile, 32x32 pixels
+static constexpr int32_t fast_clear_tile_shift{ 5 };
+
+enum
+{
+    FAST_CLEAR_FRAME = 1,
+    FAST_CLEAR_DEPTH = 2
+};
+
+struct fast_clear_data
+{
+    uint8_t* flags; // tile_w * tile_h, FAST_CLEAR_FRAME | FAST_CLEAR_DEPTH
+    int32_t tile_w;
+    int32_t tile_h;
+    uint32_t pending; // flags that may be set
+
     int32_t frame_width;
     int32_t frame_height;
-    //int32_t frame_stride; // TODO
+    int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
     float* depth_buffer;
+    ARGB* frame_buffer;
+    uint32_t color; // clear values, 32 bit patterns
+    uint32_t depth;
 };
 
+// clear the buffers of the tiles [tx0, tx1) of row ty flagged with mask and reset these flags
+void fast_clear_tiles(fast_clear_data& data, int32_t tx0, int32_t tx1, int32_t ty, uint32_t mask);
+
+// clear the tiles flagged with mask
+void fast_clear_resolve(fast_clear_data& data, uint32_t mask);
+
+//------------------------------------------------------------------------------
+
+struct occlusion_config
+{
+    int32_t frame_width;
+    int32_t frame_height;
+    int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
+    float* depth_buffer; // the mipchain is stored after the frame rows
+};
+
+// mipchain update cell, level 2 (8x8 pixels)
+static constexpr int32_t occlusion_cell_shift{ 3 };
+static constexpr uint32_t occlusion_cell_level{ 2 };
+
 struct occlusion_data
 {
     uint32_t level_count;
@@ -109,12 +285,21 @@ struct occlusion_data
         int32_t h;
     };
     level levels[level_max_count];
+
+    // cells written since the last build or update, nullptr if the chain has no cell level
+    uint8_t* dirty; // cell level w * h, stored after the mipchain
+    int32_t dirty_rect[4]; // cell x0 y0 x1 y1, empty if x0 >= x1
 };
 
 void occlusion_build_mipchain(
     occlusion_config& cfg,
     occlusion_data& data);
 
+// rebuild the dirty cells and their parents
+void occlusion_update_mipchain(
+    occlusion_config& cfg,
+    occlusion_data& data);
+
 // return true if occluded
 bool occlusion_test_rect(
     occlusion_config& cfg,
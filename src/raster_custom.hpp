@@ -0,0 +1,383 @@
+#pragma once
+#include "raster.hpp"
+#include "raster_interp.hpp"
+#include "raster_fill.hpp"
+#include "raster_span.hpp"
+#include <new>
+
+/*
+    user pixel functor, custom single pass effects
+
+    the functor is instanced in the span fill loop like the built in fill types,
+    vertex attributes are texture coordinates and vertex color: [x y] z w s t r g b a
+
+    struct fog
+    {
+        static constexpr bool use_texture{ true };
+
+        static force_inline uint32_t process(const blib3d::raster::pixel& p)
+        {
+            ...
+            return color;
+        }
+    };
+
+    renderer.set_fill_type(renderer::FILL_CUSTOM);
+    renderer.set_fill_custom(blib3d::raster::custom_raster_create<fog>);
+
+    returned color goes through mask (BLEND_MASK) and blend stage as any other fill
+*/
+
+namespace blib3d::raster
+{
+
+struct pixel
+{
+    int32_t x;
+    int32_t y;
+    real depth;
+    uint32_t texel; // sampled texture, 0 if use_texture is false
+    int32_t color[4]; // r g b a 16.16
+    uint32_t fill_color;
+    uint32_t shade_color;
+};
+
+// pixel_type::use_texture is optional, defaults to true
+template<typename pixel_type, typename = void>
+struct pixel_use_texture
+{
+    static constexpr bool value{ true };
+};
+
+template<typename pixel_type>
+struct pixel_use_texture<pixel_type, decltype((void)pixel_type::use_texture)>
+{
+    static constexpr bool value{ pixel_type::use_texture };
+};
+
+//------------------------------------------------------------------------------
+
+template<
+    typename pixel_type,
+    typename sample_type = sample_nearest,
+    typename blend_type = blend_none,
+    typename depth_type = depth_test_write,
+    typename mask_type = mask_texture_off>
+struct raster_custom : public abstract_raster
+{
+    raster_custom(const config* c)
+    {
+        back_cull = c->back_cull;
+        mip_enable = (c->flags & MIP_FACE) != 0;
+
+        texture_width = c->texture_width;
+        texture_height = c->texture_height;
+
+        frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
+        depth_buffer = c->depth_buffer;
+        frame_buffer = c->frame_buffer;
+        fill_color = reinterpret_cast<const uint32_t&>(c->fill_color);
+        shade_color = reinterpret_cast<const uint32_t&>(c->shade_color);
+
+        if (!pixel_use_texture<pixel_type>::value)
+        {
+            mip_enable = false;
+            texture_width = 1;
+            texture_height = 1;
+            smask = 0;
+            tmask = 0;
+            tshift = 16;
+            texture_lut = nullptr;
+            texture_data = nullptr;
+        }
+        else if (!mip_enable)
+        {
+            smask = (c->texture_width - 1) << 16;
+            tmask = (c->texture_height - 1) << 16;
+            tshift = 16 - math::log2(c->texture_width);
+            texture_lut = (uint32_t*)(c->texture_lut);
+            texture_data = c->texture_data;
+        }
+        else
+        {
+            texture_lut = (uint32_t*)(c->texture_lut);
+            mip_max_level = mip_table_build(c->texture_data, c->texture_width, c->texture_height, mip_table) - 1;
+        }
+    }
+
+    // abstract_raster
+
+    bool back_cull;
+    bool mip_enable;
+
+    int32_t texture_width;
+    int32_t texture_height;
+
+    const uint8_t* mip_table[mip_table_max_size];
+    int32_t mip_max_level;
+
+    bool setup_face(const real* pv[], uint32_t vertex_count) override
+    {
+        if (interp_setup_face(pv, vertex_count, back_cull,
+            is_clockwise, g))
+        {
+            real texture_width_f{ (real)texture_width };
+            real texture_height_f{ (real)texture_height };
+            if (!mip_enable)
+            {
+                g[2].dx *= texture_width_f;
+                g[2].dy *= texture_width_f;
+                g[2].d *= texture_width_f;
+                g[3].dx *= texture_height_f;
+                g[3].dy *= texture_height_f;
+                g[3].d *= texture_height_f;
+            }
+            else
+            {
+                int32_t mip_level{ mip_level_calc(pv, vertex_count, texture_width_f, texture_height_f) };
+                mip_level = math::clamp(mip_level, (int32_t)0, mip_max_level);
+                int32_t mip_texture_width{ texture_width >> mip_level };
+                int32_t mip_texture_height{ texture_height >> mip_level };
+                real mip_texture_width_f{ (real)mip_texture_width };
+                real mip_texture_height_f{ (real)mip_texture_height };
+                g[2].dx *= mip_texture_width_f;
+                g[2].dy *= mip_texture_width_f;
+                g[2].d *= mip_texture_width_f;
+                g[3].dx *= mip_texture_height_f;
+                g[3].dy *= mip_texture_height_f;
+                g[3].d *= mip_texture_height_f;
+                smask = (mip_texture_width - 1) << 16;
+                tmask = (mip_texture_height - 1) << 16;
+                tshift = 16 - math::log2(mip_texture_width);
+                texture_data = mip_table[mip_level];
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void process_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_process_algo(y, x0, x1, this);
+    }
+
+    void begin_span(int32_t y, int32_t x0, int32_t x1) override
+    {
+        span_begin_algo(y, x0, x1, this, cursor);
+    }
+
+    void process_piece(int32_t /*y*/, int32_t x0, int32_t x1) override
+    {
+        span_piece_algo(x0, x1, this, cursor);
+    }
+
+    // raster
+
+    gradient g[8];
+
+    int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
+    float* depth_buffer;
+    ARGB* frame_buffer;
+    uint32_t fill_color;
+    uint32_t shade_color;
+    int32_t smask;
+    int32_t tmask;
+    int32_t tshift;
+    const uint32_t* texture_lut;
+    const uint8_t* texture_data;
+
+    struct span_data
+    {
+        real gdx[8];
+
+        int32_t smask;
+        int32_t tmask;
+        int32_t tshift;
+        const uint32_t* texture_lut;
+        const uint8_t* texture_data;
+
+        real attrib[8];
+
+        float* depth_addr;
+        uint32_t* frame_addr;
+        int32_t attrib_int_dx[6]; // 16.16
+        int32_t attrib_int[6]; // 16.16
+        int32_t attrib_int_next[6]; // 16.16
+
+        pixel p;
+    };
+
+    span_cursor<span_data> cursor;
+
+    force_inline void setup_span(int32_t y, int32_t x0, span_data& s)
+    {
+        s.gdx[0] = g[0].dx;
+        s.gdx[1] = g[1].dx;
+        s.gdx[2] = g[2].dx;
+        s.gdx[3] = g[3].dx;
+        s.gdx[4] = g[4].dx;
+        s.gdx[5] = g[5].dx;
+        s.gdx[6] = g[6].dx;
+        s.gdx[7] = g[7].dx;
+
+        s.smask = smask;
+        s.tmask = tmask;
+        s.tshift = tshift;
+        s.texture_lut = texture_lut;
+        s.texture_data = texture_data;
+
+        s.p.x = x0;
+        s.p.y = y;
+        s.p.texel = 0;
+        s.p.fill_color = fill_color;
+        s.p.shade_color = shade_color;
+
+        real x0f{ raster_to_real(x0) };
+        real y0f{ raster_to_real(y) };
+        s.attrib[0] = g[0].dx * x0f + g[0].dy * y0f + g[0].d;
+        s.attrib[1] = g[1].dx * x0f + g[1].dy * y0f + g[1].d;
+        s.attrib[2] = g[2].dx * x0f + g[2].dy * y0f + g[2].d;
+        s.attrib[3] = g[3].dx * x0f + g[3].dy * y0f + g[3].d;
+        s.attrib[4] = g[4].dx * x0f + g[4].dy * y0f + g[4].d;
+        s.attrib[5] = g[5].dx * x0f + g[5].dy * y0f + g[5].d;
+        s.attrib[6] = g[6].dx * x0f + g[6].dy * y0f + g[6].d;
+        s.attrib[7] = g[7].dx * x0f + g[7].dy * y0f + g[7].d;
+        real w{ (real)0x10000 / s.attrib[1] };
+        s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
+        s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
+        s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[4] = math::clamp((int32_t)(s.attrib[6] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[5] = math::clamp((int32_t)(s.attrib[7] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+
+        int32_t start{ frame_offset(frame_blocked, frame_stride, x0, y) * pixel_step };
+        s.depth_addr = &depth_buffer[start];
+        s.frame_addr = reinterpret_cast<uint32_t*>(&frame_buffer[start]);
+    }
+
+    force_inline static void setup_subspan(int32_t count, span_data& s)
+    {
+        real count_real{ (real)count };
+        s.p.depth = s.attrib[0];
+        s.attrib[0] += s.gdx[0] * count_real;
+        s.attrib[1] += s.gdx[1] * count_real;
+        s.attrib[2] += s.gdx[2] * count_real;
+        s.attrib[3] += s.gdx[3] * count_real;
+        s.attrib[4] += s.gdx[4] * count_real;
+        s.attrib[5] += s.gdx[5] * count_real;
+        s.attrib[6] += s.gdx[6] * count_real;
+        s.attrib[7] += s.gdx[7] * count_real;
+        real w{ (real)0x10000 / s.attrib[1] };
+        s.attrib_int[0] = s.attrib_int_next[0];
+        s.attrib_int[1] = s.attrib_int_next[1];
+        s.attrib_int[2] = s.attrib_int_next[2];
+        s.attrib_int[3] = s.attrib_int_next[3];
+        s.attrib_int[4] = s.attrib_int_next[4];
+        s.attrib_int[5] = s.attrib_int_next[5];
+        s.attrib_int_next[0] = sample_type::process_coord((int32_t)(s.attrib[2] * w));
+        s.attrib_int_next[1] = sample_type::process_coord((int32_t)(s.attrib[3] * w));
+        s.attrib_int_next[2] = math::clamp((int32_t)(s.attrib[4] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[3] = math::clamp((int32_t)(s.attrib[5] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[4] = math::clamp((int32_t)(s.attrib[6] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        s.attrib_int_next[5] = math::clamp((int32_t)(s.attrib[7] * w), (int32_t)0, (int32_t)0x00FFFFFF);
+        if (count == span_block_size)
+        {
+            s.attrib_int_dx[0] = (s.attrib_int_next[0] - s.attrib_int[0]) >> span_block_size_shift;
+            s.attrib_int_dx[1] = (s.attrib_int_next[1] - s.attrib_int[1]) >> span_block_size_shift;
+            s.attrib_int_dx[2] = (s.attrib_int_next[2] - s.attrib_int[2]) >> span_block_size_shift;
+            s.attrib_int_dx[3] = (s.attrib_int_next[3] - s.attrib_int[3]) >> span_block_size_shift;
+            s.attrib_int_dx[4] = (s.attrib_int_next[4] - s.attrib_int[4]) >> span_block_size_shift;
+            s.attrib_int_dx[5] = (s.attrib_int_next[5] - s.attrib_int[5]) >> span_block_size_shift;
+        }
+        else
+        {
+            real scale{ subspan_scale[count] };
+            s.attrib_int_dx[0] = (int32_t)((real)(s.attrib_int_next[0] - s.attrib_int[0]) * scale);
+            s.attrib_int_dx[1] = (int32_t)((real)(s.attrib_int_next[1] - s.attrib_int[1]) * scale);
+            s.attrib_int_dx[2] = (int32_t)((real)(s.attrib_int_next[2] - s.attrib_int[2]) * scale);
+            s.attrib_int_dx[3] = (int32_t)((real)(s.attrib_int_next[3] - s.attrib_int[3]) * scale);
+            s.attrib_int_dx[4] = (int32_t)((real)(s.attrib_int_next[4] - s.attrib_int[4]) * scale);
+            s.attrib_int_dx[5] = (int32_t)((real)(s.attrib_int_next[5] - s.attrib_int[5]) * scale);
+        }
+    }
+
+    template<int32_t step>
+    force_inline static void skip(int32_t count, span_data& s)
+    {
+        s.depth_addr += count * step;
+        s.frame_addr += count * step;
+    }
+
+    template<int32_t step, bool draw = true>
+    force_inline static void fill(span_data& s)
+    {
+        if (draw && depth_type::process_test(s.depth_addr, s.p.depth))
+        {
+            if (pixel_use_texture<pixel_type>::value)
+                s.p.texel = sample_type::process_texel(
+                    s.attrib_int[0],
+                    s.attrib_int[1],
+                    s.smask, s.tmask, s.tshift, s.texture_lut, s.texture_data);
+            s.p.color[0] = s.attrib_int[2];
+            s.p.color[1] = s.attrib_int[3];
+            s.p.color[2] = s.attrib_int[4];
+            s.p.color[3] = s.attrib_int[5];
+            uint32_t color{ pixel_type::process(s.p) };
+            if (mask_type::process(color))
+            {
+                blend_type::process(s.frame_addr, color);
+                depth_type::process_write(s.depth_addr, s.p.depth);
+            }
+        }
+
+        s.p.x++;
+        s.p.depth += s.gdx[0];
+        s.attrib_int[0] += s.attrib_int_dx[0];
+        s.attrib_int[1] += s.attrib_int_dx[1];
+        s.attrib_int[2] += s.attrib_int_dx[2];
+        s.attrib_int[3] += s.attrib_int_dx[3];
+        s.attrib_int[4] += s.attrib_int_dx[4];
+        s.attrib_int[5] += s.attrib_int_dx[5];
+
+        s.depth_addr += step;
+        s.frame_addr += step;
+    }
+};
+
+//------------------------------------------------------------------------------
+
+template<typename pixel_type, typename sample_type>
+abstract_raster* custom_raster_create_sample(const config* c, void* storage)
+{
+    switch (c->flags & BLEND_BIT_MASK)
+    {
+    case BLEND_NONE:
+        return new (storage) raster_custom<pixel_type, sample_type>(c);
+    case BLEND_MASK:
+        return new (storage) raster_custom<pixel_type, sample_type, blend_none, depth_test_write, mask_texture_on>(c);
+    case BLEND_ADD:
+        return new (storage) raster_custom<pixel_type, sample_type, blend_add, depth_test>(c);
+    case BLEND_MUL:
+        return new (storage) raster_custom<pixel_type, sample_type, blend_mul, depth_test>(c);
+    case BLEND_ALPHA:
+        return new (storage) raster_custom<pixel_type, sample_type, blend_alpha, depth_test>(c);
+    }
+    return nullptr;
+}
+
+// custom_raster_factory for pixel_type
+template<typename pixel_type>
+abstract_raster* custom_raster_create(const config* c, void* storage)
+{
+    static_assert(sizeof(raster_custom<pixel_type>) <= custom_raster_max_size);
+
+    if ((c->flags & FILTER_BIT_MASK) == FILTER_LINEAR)
+        return custom_raster_create_sample<pixel_type, sample_bilinear>(c, storage);
+    return custom_raster_create_sample<pixel_type, sample_nearest>(c, storage);
+}
+
+} // namespace blib3d::raster
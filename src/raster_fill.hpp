@@ -74,38 +74,52 @@ struct blend_alpha
 
 struct depth_off
 {
-    static force_inline bool process_test(float* /*buffer*/, float /*depth*/)
+    static force_inline bool process_test(float* /*buffer*/, real /*depth*/)
     {
         return true;
     }
 
-    static force_inline void process_write(float* /*buffer*/, float /*depth*/)
+    static force_inline void process_write(float* /*buffer*/, real /*depth*/)
     {
     }
 };
 
 struct depth_test
 {
-    static force_inline bool process_test(float* buffer, float depth)
+    static force_inline bool process_test(float* buffer, real depth)
     {
         return *buffer > depth;
     }
 
-    static force_inline void process_write(float* /*buffer*/, float /*depth*/)
+    static force_inline void process_write(float* /*buffer*/, real /*depth*/)
     {
     }
 };
 
 struct depth_test_write
 {
-    static force_inline bool process_test(float* buffer, float depth)
+    static force_inline bool process_test(float* buffer, real depth)
     {
         return *buffer > depth;
     }
 
-    static force_inline void process_write(float* buffer, float depth)
+    static force_inline void process_write(float* buffer, real depth)
     {
-        *buffer = depth;
+        *buffer = math::to_float(depth);
+    }
+};
+
+// pixels known to be in front
+struct depth_write
+{
+    static force_inline bool process_test(float* /*buffer*/, real /*depth*/)
+    {
+        return true;
+    }
+
+    static force_inline void process_write(float* buffer, real depth)
+    {
+        *buffer = math::to_float(depth);
     }
 };
 
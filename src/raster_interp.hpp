@@ -5,24 +5,24 @@ namespace blib3d::raster
 
 struct gradient
 {
-    float dx;
-    float dy;
-    float d;
+    real dx;
+    real dy;
+    real d;
 };
 
 template<uint32_t size>
-bool interp_setup_face(const float* pv[], uint32_t vertex_count, bool back_cull,
+bool interp_setup_face(const real* pv[], uint32_t vertex_count, bool back_cull,
     bool& is_clockwise, gradient (&g)[size])
 {
-    constexpr float discard_thresh{ 1.f };
+    constexpr real discard_thresh{ 1.f };
 
     constexpr uint32_t num_max_triangles{ num_max_vertices - 2 };
     const uint32_t num_triangles{ vertex_count - 2 };
 
-    float v0[num_max_triangles][2];
-    float v1[num_max_triangles][2];
+    real v0[num_max_triangles][2];
+    real v1[num_max_triangles][2];
 
-    float area2xy{ 0.f };
+    real area2xy{ 0.f };
 
     constexpr uint32_t nv0{ 0 };
     uint32_t nv1{ 1 };
@@ -53,8 +53,8 @@ bool interp_setup_face(const float* pv[], uint32_t vertex_count, bool back_cull,
 
     is_clockwise = clockwise;
 
-    float area2cx[num_max_attributes]{};
-    float area2cy[num_max_attributes]{};
+    real area2cx[num_max_attributes]{};
+    real area2cy[num_max_attributes]{};
 
     //nv0 = 0;
     nv1 = 1;
@@ -63,8 +63,8 @@ bool interp_setup_face(const float* pv[], uint32_t vertex_count, bool back_cull,
     {
         for (uint32_t n{ 0 }, nc{ 2 }; n < size; ++n, ++nc)
         {
-            float v0c{ pv[nv1][nc] - pv[nv0][nc] }; // v0->v1
-            float v1c{ pv[nv2][nc] - pv[nv0][nc] }; // v0->v2
+            real v0c{ pv[nv1][nc] - pv[nv0][nc] }; // v0->v1
+            real v1c{ pv[nv2][nc] - pv[nv0][nc] }; // v0->v2
             area2cx[n] += math::cross2(v0c, v0[nt][0], v1c, v1[nt][0]);
             area2cy[n] += math::cross2(v0c, v0[nt][1], v1c, v1[nt][1]);
         }
@@ -73,7 +73,7 @@ bool interp_setup_face(const float* pv[], uint32_t vertex_count, bool back_cull,
         ++nv2;
     }
 
-    float area2xyinv{ 1.f / area2xy };
+    real area2xyinv{ 1.f / area2xy };
 
     for (uint32_t n{ 0 }, nc{ 2 }; n < size; ++n, ++nc)
     {
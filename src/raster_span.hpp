@@ -0,0 +1,323 @@
+#pragma once
+
+namespace blib3d::raster
+{
+
+//------------------------------------------------------------------------------
+
+struct abstract_raster
+{
+    bool is_clockwise;
+
+    virtual bool setup_face(const real* pv[], uint32_t vertex_count) = 0;
+    virtual void process_span(int32_t y, int32_t x0, int32_t x1) = 0;
+
+    // a span drawn in pieces, process_piece is called in increasing x order inside
+    // [x0, x1) of begin_span, the pixels keep the interpolation of the whole span
+    virtual void begin_span(int32_t /*y*/, int32_t /*x0*/, int32_t /*x1*/) {}
+    virtual void process_piece(int32_t y, int32_t x0, int32_t x1) { process_span(y, x0, x1); }
+};
+
+//------------------------------------------------------------------------------
+
+force_inline int32_t real_to_raster(real v)
+{
+    return math::ceil(v - 0.5f);
+}
+
+force_inline real raster_to_real(int32_t v)
+{
+    return (real)v + 0.5f;
+}
+
+//------------------------------------------------------------------------------
+
+// mark the mipchain cells of the pixel rect [x0, x1) x [y0, y1) as written
+force_inline void occlusion_mark_dirty(occlusion_data* o, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    int32_t cx0{ x0 >> occlusion_cell_shift };
+    int32_t cy0{ y0 >> occlusion_cell_shift };
+    int32_t cx1{ ((x1 - 1) >> occlusion_cell_shift) + 1 };
+    int32_t cy1{ ((y1 - 1) >> occlusion_cell_shift) + 1 };
+    int32_t w{ o->levels[occlusion_cell_level].w };
+    for (int32_t cy{ cy0 }; cy < cy1; ++cy)
+    {
+        uint8_t* p{ &o->dirty[w * cy] };
+        for (int32_t cx{ cx0 }; cx < cx1; ++cx)
+            p[cx] = 1;
+    }
+    int32_t* rect{ o->dirty_rect };
+    rect[0] = math::min(rect[0], cx0);
+    rect[1] = math::min(rect[1], cy0);
+    rect[2] = math::max(rect[2], cx1);
+    rect[3] = math::max(rect[3], cy1);
+}
+
+// clear the flagged tiles of the pixel rect [x0, x1) x [y0, y1)
+force_inline void fast_clear_rect(fast_clear_data* f, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    int32_t tx0{ x0 >> fast_clear_tile_shift };
+    int32_t ty0{ y0 >> fast_clear_tile_shift };
+    int32_t tx1{ ((x1 - 1) >> fast_clear_tile_shift) + 1 };
+    int32_t ty1{ ((y1 - 1) >> fast_clear_tile_shift) + 1 };
+    for (int32_t ty{ ty0 }; ty < ty1; ++ty)
+    {
+        const uint8_t* p{ &f->flags[f->tile_w * ty] };
+        for (int32_t tx{ tx0 }; tx < tx1; ++tx)
+        {
+            if (p[tx])
+            {
+                fast_clear_tiles(*f, tx, tx1, ty, FAST_CLEAR_FRAME | FAST_CLEAR_DEPTH);
+                break;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/*
+    span fill algorithm
+*/
+
+constexpr int32_t span_block_size{ 16 };
+constexpr int32_t span_block_size_shift{ 4 };
+
+template<int32_t step, typename raster_type>
+force_inline void span_process_step(int32_t y, int32_t x0, int32_t x1, raster_type* r)
+{
+    //assert(x0 < x1);
+    typename raster_type::span_data s;
+    r->setup_span(y, x0, s);
+    int32_t n{ x1 - x0 };
+    if (!r->frame_blocked)
+    {
+        while (n)
+        {
+            int32_t c{ math::min(n, span_block_size) };
+            n -= c;
+            raster_type::setup_subspan(c, s);
+            while (c--)
+                raster_type::template fill<step>(s);
+        }
+        return;
+    }
+
+    // blocked frame, same subspans, the addresses move to the next block at block ends
+    static_assert(span_block_size <= frame_block_width);
+    int32_t b{ frame_block_width - (x0 & (frame_block_width - 1)) }; // pixels to the block end
+    while (n)
+    {
+        int32_t c{ math::min(n, span_block_size) };
+        n -= c;
+        raster_type::setup_subspan(c, s);
+        int32_t a{ math::min(c, b) };
+        c -= a;
+        b -= a;
+        while (a--)
+            raster_type::template fill<step>(s);
+        if (b == 0)
+        {
+            raster_type::template skip<step>(frame_block_width * (frame_block_height - 1), s);
+            b = frame_block_width;
+        }
+        b -= c;
+        while (c--)
+            raster_type::template fill<step>(s);
+    }
+}
+
+// the pixel step is a constant of the fill loops
+template<typename raster_type>
+force_inline void span_process_algo(int32_t y, int32_t x0, int32_t x1, raster_type* r)
+{
+#if defined(USE_FRAME_INTERLEAVED)
+    if (r->pixel_step != 1)
+    {
+        span_process_step<2>(y, x0, x1, r);
+        return;
+    }
+#endif
+    span_process_step<1>(y, x0, x1, r);
+}
+
+/*
+    span fill in pieces, same subspans and steps as span_process_algo over the
+    whole span, the pixels between the pieces are stepped without drawing the
+    same way as pixels that fail the depth test
+*/
+
+template<typename span_data>
+struct span_cursor
+{
+    span_data s;
+    int32_t x; // next pixel
+    int32_t x1; // span end
+    int32_t c; // pixels left in the subspan
+    int32_t b; // pixels to the block end, blocked frame
+};
+
+template<typename raster_type, typename span_data>
+force_inline void span_begin_algo(int32_t y, int32_t x0, int32_t x1, raster_type* r, span_cursor<span_data>& k)
+{
+    r->setup_span(y, x0, k.s);
+    k.x = x0;
+    k.x1 = x1;
+    k.c = 0;
+    k.b = frame_block_width - (x0 & (frame_block_width - 1));
+}
+
+template<int32_t step, bool draw, typename raster_type, typename span_data>
+force_inline void span_piece_fill(int32_t n, raster_type* r, span_cursor<span_data>& k)
+{
+    if (!r->frame_blocked)
+    {
+        while (n--)
+            raster_type::template fill<step, draw>(k.s);
+        return;
+    }
+    while (n--)
+    {
+        raster_type::template fill<step, draw>(k.s);
+        if (--k.b == 0)
+        {
+            raster_type::template skip<step>(frame_block_width * (frame_block_height - 1), k.s);
+            k.b = frame_block_width;
+        }
+    }
+}
+
+template<int32_t step, typename raster_type, typename span_data>
+force_inline void span_piece_step(int32_t x0, int32_t x1, raster_type* r, span_cursor<span_data>& k)
+{
+    while (k.x < x1)
+    {
+        if (k.c == 0)
+        {
+            k.c = math::min(k.x1 - k.x, span_block_size);
+            raster_type::setup_subspan(k.c, k.s);
+        }
+        int32_t n{ math::min(k.c, x1 - k.x) };
+        int32_t skipped{ math::clamp(x0 - k.x, (int32_t)0, n) };
+        k.c -= n;
+        k.x += n;
+        span_piece_fill<step, false>(skipped, r, k);
+        span_piece_fill<step, true>(n - skipped, r, k);
+    }
+}
+
+template<typename raster_type, typename span_data>
+force_inline void span_piece_algo(int32_t x0, int32_t x1, raster_type* r, span_cursor<span_data>& k)
+{
+#if defined(USE_FRAME_INTERLEAVED)
+    if (r->pixel_step != 1)
+    {
+        span_piece_step<2>(x0, x1, r, k);
+        return;
+    }
+#endif
+    span_piece_step<1>(x0, x1, r, k);
+}
+
+//template<typename raster_type>
+//force_inline void span_process_algo(raster_type& raster, int32_t y, int32_t x0, int32_t x1)
+//{
+//    //assert(x0 < x1);
+//    raster.setup_span(y, x0);
+//    while (x0 != x1)
+//    {
+//        int32_t n{ (x0 + span_block_size) & ~(span_block_size - 1) };
+//        int32_t c{ math::min(n, x1) - x0 };
+//        x0 += c;
+//        raster.setup_subspan(c);
+//        while (c--)
+//            raster.fill();
+//    }
+//}
+
+constexpr real subspan_scale[span_block_size]
+{
+           0, 1.f /  1, 1.f /  2, 1.f /  3,
+    1.f /  4, 1.f /  5, 1.f /  6, 1.f /  7,
+    1.f /  8, 1.f /  9, 1.f / 10, 1.f / 11,
+    1.f / 12, 1.f / 13, 1.f / 14, 1.f / 15
+};
+
+static constexpr uint32_t shade_hold{ 4 };
+static constexpr uint32_t shade_mask{ shade_hold - 1 };
+
+//------------------------------------------------------------------------------
+
+inline int32_t mip_level_calc(const real* v[], uint32_t num_vertices, real texture_width, real texture_height)
+{
+    enum { x, y, zdivw, winv, udivw, vdivw };
+
+    real xy[2][2]; // v0->v1, v0->v2
+    real uv[2][2]; // v0->v1, v0->v2
+    real w0{ 1.f / v[0][winv] };
+    real w1{ 1.f / v[1][winv] };
+    real x0{ v[0][x] };
+    real y0{ v[0][y] };
+    real u0{ v[0][udivw] * w0 };
+    real v0{ v[0][vdivw] * w0 };
+    xy[0][0] = v[1][x] - x0;
+    xy[0][1] = v[1][y] - y0;
+    uv[0][0] = v[1][udivw] * w1 - u0;
+    uv[0][1] = v[1][vdivw] * w1 - v0;
+
+    real a2xy{ 0.f };
+    real a2uv{ 0.f };
+
+    for (uint32_t nv2{ 2 }; nv2 < num_vertices; ++nv2)
+    {
+        real w2{ 1.f / v[nv2][winv] };
+        xy[1][0] = v[nv2][x] - x0;
+        xy[1][1] = v[nv2][y] - y0;
+        uv[1][0] = v[nv2][udivw] * w2 - u0;
+        uv[1][1] = v[nv2][vdivw] * w2 - v0;
+
+        a2xy += math::cross2(xy[0][0], xy[0][1], xy[1][0], xy[1][1]);
+        a2uv += math::cross2(uv[0][0], uv[0][1], uv[1][0], uv[1][1]);
+
+        xy[0][0] = xy[1][0];
+        xy[0][1] = xy[1][1];
+        uv[0][0] = uv[1][0];
+        uv[0][1] = uv[1][1];
+    }
+
+    a2uv *= texture_width * texture_height;
+
+    real l{ math::sqrt(math::abs(a2uv / a2xy)) };
+
+    return math::log2ceil(l);
+}
+
+constexpr int32_t mip_table_max_size{ 16 };
+
+inline int32_t mip_table_build(
+    const uint8_t* texture,
+    int32_t texture_width,
+    int32_t texture_height,
+    uint8_t const* mip_table[])
+{
+    int32_t n{ 0 };
+    for (;;)
+    {
+        mip_table[n++] = texture;
+        if (texture_width != 1 && texture_height != 1 && n < mip_table_max_size)
+        {
+            texture += texture_width * texture_height;
+            texture_width >>= 1;
+            texture_height >>= 1;
+        }
+        else
+            break;
+    }
+    for (int32_t i{ n }; i < mip_table_max_size; ++i)
+        mip_table[i] = nullptr;
+    return n;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace blib3d::raster
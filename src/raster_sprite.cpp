@@ -0,0 +1,473 @@
+#include "raster.hpp"
+#include "raster_fill.hpp"
+#include "raster_span.hpp"
+#include "simd.hpp"
+#include <cfloat>
+#include <new>
+
+namespace blib3d::raster
+{
+
+//------------------------------------------------------------------------------
+
+/*
+    sprites are axis aligned rects at constant depth
+    no perspective correction and no edge walking, texture coordinates are
+    stepped with a constant 16.16 increment along x and y
+*/
+
+struct abstract_sprite_raster
+{
+    virtual void process_rect(const sprite& sp, int32_t x0, int32_t y0, int32_t x1, int32_t y1) = 0;
+};
+
+//------------------------------------------------------------------------------
+
+struct sprite_shade_none
+{
+    static force_inline void setup(ARGB /*color*/, uint32_t /*shade*/[4])
+    {
+    }
+
+    static force_inline uint32_t process(uint32_t texel, const uint32_t /*shade*/[4])
+    {
+        return texel;
+    }
+};
+
+// modulate texel by sprite color, 255 is identity
+struct sprite_shade_color
+{
+    static force_inline void setup(ARGB color, uint32_t shade[4])
+    {
+        shade[0] = (uint32_t)color.a + ((uint32_t)color.a >> 7u);
+        shade[1] = (uint32_t)color.r + ((uint32_t)color.r >> 7u);
+        shade[2] = (uint32_t)color.g + ((uint32_t)color.g >> 7u);
+        shade[3] = (uint32_t)color.b + ((uint32_t)color.b >> 7u);
+    }
+
+    static force_inline uint32_t process(uint32_t texel, const uint32_t shade[4])
+    {
+        return
+            ((((texel >> 24u)        ) * shade[0]) >> 8u << 24u) +
+            ((((texel >> 16u) & 0xFFu) * shade[1]) >> 8u << 16u) +
+            ((((texel >>  8u) & 0xFFu) * shade[2]) >> 8u <<  8u) +
+            ((((texel       ) & 0xFFu) * shade[3]) >> 8u       );
+    }
+};
+
+//------------------------------------------------------------------------------
+
+template<typename blend_type, typename depth_type>
+struct sprite_span_solid
+{
+    static force_inline void process(float* depth_addr, uint32_t* frame_addr, int32_t step, int32_t n, real depth, uint32_t color)
+    {
+        while (n--)
+        {
+            if (depth_type::process_test(depth_addr, depth))
+            {
+                blend_type::process(frame_addr, color);
+                depth_type::process_write(depth_addr, depth);
+            }
+            depth_addr += step;
+            frame_addr += step;
+        }
+    }
+};
+
+#if defined(USE_SIMD) && !defined(USE_FIXED_POINT)
+// opaque depth tested span, 4 pixels per step
+template<>
+struct sprite_span_solid<blend_none, depth_test_write>
+{
+    static force_inline void process(float* depth_addr, uint32_t* frame_addr, int32_t step, int32_t n, real depth, uint32_t color)
+    {
+        simd::f32x4 depth4{ simd::set1(depth) };
+        simd::u32x4 color4{ simd::set1(color) };
+        for (; step == 1 && n >= 4; n -= 4, depth_addr += 4, frame_addr += 4)
+        {
+            simd::f32x4 d{ simd::load(depth_addr) };
+            simd::u32x4 m{ simd::cmpgt(d, depth4) };
+            simd::store(frame_addr, simd::select(m, color4, simd::load(frame_addr)));
+            simd::store(depth_addr, simd::select(m, depth4, d));
+        }
+        while (n--)
+        {
+            if (depth_test_write::process_test(depth_addr, depth))
+            {
+                blend_none::process(frame_addr, color);
+                depth_test_write::process_write(depth_addr, depth);
+            }
+            depth_addr += step;
+            frame_addr += step;
+        }
+    }
+};
+#endif
+
+template<typename blend_type = blend_none, typename depth_type = depth_test_write>
+struct sprite_raster_solid : public abstract_sprite_raster
+{
+    sprite_raster_solid(const config* c)
+    {
+        frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
+        depth_buffer = c->depth_buffer;
+        frame_buffer = c->frame_buffer;
+    }
+
+    int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
+    float* depth_buffer;
+    ARGB* frame_buffer;
+
+    void process_rect(const sprite& sp, int32_t x0, int32_t y0, int32_t x1, int32_t y1) override
+    {
+        uint32_t color{ reinterpret_cast<const uint32_t&>(sp.color) };
+        real depth{ sp.depth };
+
+        float* depth_data{ depth_buffer };
+        uint32_t* frame_data{ reinterpret_cast<uint32_t*>(frame_buffer) };
+
+        for (int32_t y{ y0 }; y < y1; ++y)
+        {
+            frame_row_pieces(frame_blocked, frame_stride, x0, x1, y, [&](int32_t offset, int32_t /*x*/, int32_t count)
+            {
+                int32_t start{ offset * pixel_step };
+                sprite_span_solid<blend_type, depth_type>::process(&depth_data[start], &frame_data[start], pixel_step, count, depth, color);
+            });
+        }
+    }
+};
+
+template<
+    typename sample_type = sample_nearest,
+    typename shade_type = sprite_shade_none,
+    typename blend_type = blend_none,
+    typename depth_type = depth_test_write,
+    typename mask_type = mask_texture_off>
+struct sprite_raster_texture : public abstract_sprite_raster
+{
+    sprite_raster_texture(const config* c)
+    {
+        frame_stride = c->frame_stride;
+        frame_blocked = c->frame_blocked;
+        pixel_step = c->pixel_step;
+        depth_buffer = c->depth_buffer;
+        frame_buffer = c->frame_buffer;
+
+        texture_width = c->texture_width;
+        texture_height = c->texture_height;
+        smask = (c->texture_width - 1) << 16;
+        tmask = (c->texture_height - 1) << 16;
+        tshift = 16 - math::log2(c->texture_width);
+        texture_lut = (uint32_t*)(c->texture_lut);
+        texture_data = c->texture_data;
+    }
+
+    int32_t frame_stride;
+    bool frame_blocked;
+    int32_t pixel_step;
+    float* depth_buffer;
+    ARGB* frame_buffer;
+
+    int32_t texture_width;
+    int32_t texture_height;
+    int32_t smask;
+    int32_t tmask;
+    int32_t tshift;
+    const uint32_t* texture_lut;
+    const uint8_t* texture_data;
+
+    void process_rect(const sprite& sp, int32_t x0, int32_t y0, int32_t x1, int32_t y1) override
+    {
+        uint32_t shade[4];
+        shade_type::setup(sp.color, shade);
+        real depth{ sp.depth };
+
+        // texels per pixel
+        real sdx{ (sp.s1 - sp.s0) * (real)texture_width / (sp.x1 - sp.x0) };
+        real tdy{ (sp.t1 - sp.t0) * (real)texture_height / (sp.y1 - sp.y0) };
+        real s0f{ sp.s0 * (real)texture_width + (raster_to_real(x0) - sp.x0) * sdx };
+        real t0f{ sp.t0 * (real)texture_height + (raster_to_real(y0) - sp.y0) * tdy };
+        int32_t s_dx{ (int32_t)(sdx * (real)0x10000) };
+        int32_t t_dy{ (int32_t)(tdy * (real)0x10000) };
+        int32_t s_start{ sample_type::process_coord((int32_t)(s0f * (real)0x10000)) };
+        int32_t t{ sample_type::process_coord((int32_t)(t0f * (real)0x10000)) };
+
+        int32_t smask_{ smask };
+        int32_t tmask_{ tmask };
+        int32_t tshift_{ tshift };
+        const uint32_t* texture_lut_{ texture_lut };
+        const uint8_t* texture_data_{ texture_data };
+
+        float* depth_data{ depth_buffer };
+        uint32_t* frame_data{ reinterpret_cast<uint32_t*>(frame_buffer) };
+
+        for (int32_t y{ y0 }; y < y1; ++y)
+        {
+            int32_t s{ s_start };
+            frame_row_pieces(frame_blocked, frame_stride, x0, x1, y, [&](int32_t offset, int32_t /*x*/, int32_t n)
+            {
+                float* depth_addr{ &depth_data[offset * pixel_step] };
+                uint32_t* frame_addr{ &frame_data[offset * pixel_step] };
+                while (n--)
+                {
+                    if (depth_type::process_test(depth_addr, depth))
+                    {
+                        uint32_t texel{ sample_type::process_texel(
+                            s, t, smask_, tmask_, tshift_, texture_lut_, texture_data_) };
+                        if (mask_type::process(texel))
+                        {
+                            blend_type::process(frame_addr, shade_type::process(texel, shade));
+                            depth_type::process_write(depth_addr, depth);
+                        }
+                    }
+                    s += s_dx;
+                    depth_addr += pixel_step;
+                    frame_addr += pixel_step;
+                }
+            });
+            t += t_dy;
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+
+// sprites do not go through the depth tile raster, keep the tile min conservative
+static void sprite_depth_tile(float* depth_tile, int32_t depth_tile_stride, int32_t x0, int32_t y0, int32_t x1, int32_t y1, float depth)
+{
+    int32_t tx0{ x0 >> depth_tile_shift };
+    int32_t tx1{ ((x1 - 1) >> depth_tile_shift) + 1 };
+    for (int32_t y{ y0 }; y < y1; ++y)
+    {
+        float* t{ &depth_tile[(depth_tile_stride * y + tx0) * 2] };
+        for (int32_t tx{ tx0 }; tx < tx1; ++tx, t += 2)
+            t[0] = math::depth_min(t[0], depth);
+    }
+}
+
+void scan_sprites(const config* c, const sprite* sprites, uint32_t count)
+{
+    abstract_sprite_raster* r{};
+
+    //------------------------------------//
+
+    union raster_pool
+    {
+        sprite_raster_solid<> r0;
+        sprite_raster_texture<> r1;
+    };
+    alignas(alignof(raster_pool)) uint8_t raster[sizeof(raster_pool)];
+
+    switch (c->flags & FILL_BIT_MASK)
+    {
+    case FILL_SOLID:
+        switch (c->flags & BLEND_BIT_MASK)
+        {
+        case BLEND_NONE:
+            r = new (raster) sprite_raster_solid<>(c);
+            break;
+        case BLEND_ADD:
+            r = new (raster) sprite_raster_solid<blend_add, depth_test>(c);
+            break;
+        case BLEND_MUL:
+            r = new (raster) sprite_raster_solid<blend_mul, depth_test>(c);
+            break;
+        case BLEND_ALPHA:
+            r = new (raster) sprite_raster_solid<blend_alpha, depth_test>(c);
+            break;
+        }
+        break;
+    case FILL_TEXTURE:
+        // lightmap shading does not apply, only the vertex bit is checked
+        switch (c->flags & (SHADE_VERTEX | BLEND_BIT_MASK | FILTER_BIT_MASK))
+        {
+        case (SHADE_NONE | BLEND_NONE | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest>(c);
+            break;
+        case (SHADE_NONE | BLEND_MASK | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_none, blend_none, depth_test_write, mask_texture_on>(c);
+            break;
+        case (SHADE_NONE | BLEND_ADD | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_none, blend_add, depth_test>(c);
+            break;
+        case (SHADE_NONE | BLEND_MUL | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_none, blend_mul, depth_test>(c);
+            break;
+        case (SHADE_NONE | BLEND_ALPHA | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_none, blend_alpha, depth_test>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_NONE | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_color>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_MASK | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_color, blend_none, depth_test_write, mask_texture_on>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_ADD | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_color, blend_add, depth_test>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_MUL | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_color, blend_mul, depth_test>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_ALPHA | FILTER_NONE):
+            r = new (raster) sprite_raster_texture<sample_nearest, sprite_shade_color, blend_alpha, depth_test>(c);
+            break;
+        case (SHADE_NONE | BLEND_NONE | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear>(c);
+            break;
+        case (SHADE_NONE | BLEND_MASK | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_none, blend_none, depth_test_write, mask_texture_on>(c);
+            break;
+        case (SHADE_NONE | BLEND_ADD | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_none, blend_add, depth_test>(c);
+            break;
+        case (SHADE_NONE | BLEND_MUL | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_none, blend_mul, depth_test>(c);
+            break;
+        case (SHADE_NONE | BLEND_ALPHA | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_none, blend_alpha, depth_test>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_NONE | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_color>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_MASK | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_color, blend_none, depth_test_write, mask_texture_on>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_ADD | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_color, blend_add, depth_test>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_MUL | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_color, blend_mul, depth_test>(c);
+            break;
+        case (SHADE_VERTEX | BLEND_ALPHA | FILTER_LINEAR):
+            r = new (raster) sprite_raster_texture<sample_bilinear, sprite_shade_color, blend_alpha, depth_test>(c);
+            break;
+        }
+        break;
+    }
+
+    //------------------------------------//
+
+    if (r == nullptr)
+        return;
+
+    int32_t frame_width{ c->frame_width };
+    int32_t frame_height{ c->frame_height };
+
+    bool depth_write{
+        (c->flags & BLEND_BIT_MASK) == BLEND_NONE ||
+        (c->flags & BLEND_BIT_MASK) == BLEND_MASK };
+
+    occlusion_data* occlusion{};
+    if (depth_write && c->occlusion != nullptr && c->occlusion->dirty != nullptr)
+        occlusion = c->occlusion;
+
+    float* depth_tile{ depth_write ? c->depth_tile : nullptr };
+    int32_t depth_tile_stride{ c->depth_tile_stride };
+
+    while (count--)
+    {
+        const sprite& sp{ *sprites++ };
+
+        // pixel centers inside the rect, same rule as scan_face, clipped to the frame
+
+        int32_t x0{ math::max(real_to_raster(sp.x0), (int32_t)0) };
+        int32_t y0{ math::max(real_to_raster(sp.y0), (int32_t)0) };
+        int32_t x1{ math::min(real_to_raster(sp.x1), frame_width) };
+        int32_t y1{ math::min(real_to_raster(sp.y1), frame_height) };
+
+        if (x0 < x1 && y0 < y1)
+        {
+            if (c->fast_clear)
+                fast_clear_rect(c->fast_clear, x0, y0, x1, y1);
+            r->process_rect(sp, x0, y0, x1, y1);
+            if (occlusion)
+                occlusion_mark_dirty(occlusion, x0, y0, x1, y1);
+            if (depth_tile)
+                sprite_depth_tile(depth_tile, depth_tile_stride, x0, y0, x1, y1, math::to_float(sp.depth));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void scan_depth_image(const config* c, const depth_image& image, const sprite& sp)
+{
+    int32_t x0{ math::max(real_to_raster(sp.x0), (int32_t)0) };
+    int32_t y0{ math::max(real_to_raster(sp.y0), (int32_t)0) };
+    int32_t x1{ math::min(real_to_raster(sp.x1), c->frame_width) };
+    int32_t y1{ math::min(real_to_raster(sp.y1), c->frame_height) };
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (c->fast_clear)
+        fast_clear_rect(c->fast_clear, x0, y0, x1, y1);
+
+    // image pixels per screen pixel, 16.16
+    real sdx{ (sp.s1 - sp.s0) * (real)image.width / (sp.x1 - sp.x0) };
+    real tdy{ (sp.t1 - sp.t0) * (real)image.height / (sp.y1 - sp.y0) };
+    real s0f{ sp.s0 * (real)image.width + (raster_to_real(x0) - sp.x0) * sdx };
+    real t0f{ sp.t0 * (real)image.height + (raster_to_real(y0) - sp.y0) * tdy };
+    int32_t s_dx{ (int32_t)(sdx * (real)0x10000) };
+    int32_t t_dy{ (int32_t)(tdy * (real)0x10000) };
+    int32_t s_start{ (int32_t)(s0f * (real)0x10000) };
+    int32_t t{ (int32_t)(t0f * (real)0x10000) };
+
+    int32_t s_max{ image.width - 1 };
+    int32_t t_max{ image.height - 1 };
+    real depth_offset{ sp.depth };
+    float depth_min{ FLT_MAX };
+
+    float* depth_data{ c->depth_buffer };
+    uint32_t* frame_data{ reinterpret_cast<uint32_t*>(c->frame_buffer) };
+    int32_t pixel_step{ c->pixel_step };
+
+    for (int32_t y{ y0 }; y < y1; ++y)
+    {
+        int32_t row{ math::clamp(t >> 16, (int32_t)0, t_max) * image.width };
+        const uint32_t* image_color{ reinterpret_cast<const uint32_t*>(image.color) + row };
+        const float* image_depth{ image.depth + row };
+        int32_t s{ s_start };
+        frame_row_pieces(c->frame_blocked, c->frame_stride, x0, x1, y, [&](int32_t offset, int32_t /*x*/, int32_t n)
+        {
+            float* depth_addr{ &depth_data[offset * pixel_step] };
+            uint32_t* frame_addr{ &frame_data[offset * pixel_step] };
+            while (n--)
+            {
+                int32_t i{ math::clamp(s >> 16, (int32_t)0, s_max) };
+                float d{ image_depth[i] };
+                if (math::depth_less(d, FLT_MAX))
+                {
+                    real depth{ math::to_real(d) + depth_offset };
+                    if (depth_test_write::process_test(depth_addr, depth))
+                    {
+                        *frame_addr = image_color[i];
+                        depth_test_write::process_write(depth_addr, depth);
+                        depth_min = math::depth_min(depth_min, *depth_addr);
+                    }
+                }
+                s += s_dx;
+                depth_addr += pixel_step;
+                frame_addr += pixel_step;
+            }
+        });
+        t += t_dy;
+    }
+
+    if (!math::depth_less(depth_min, FLT_MAX))
+        return;
+    if (c->occlusion != nullptr && c->occlusion->dirty != nullptr)
+        occlusion_mark_dirty(c->occlusion, x0, y0, x1, y1);
+    if (c->depth_tile)
+        sprite_depth_tile(c->depth_tile, c->depth_tile_stride, x0, y0, x1, y1, depth_min);
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace blib3d::raster
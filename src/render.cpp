@@ -1,5 +1,7 @@
 ﻿#include "render.hpp"
+#include "cpu.hpp"
 #include <cassert>
+#include <cstring>
 
 namespace blib3d::render
 {
@@ -8,14 +10,14 @@ namespace blib3d::render
 // num_out_vertices has the number of output vertices
 // returns the number of the buffer with the output face
 uint32_t clip_face(
-    float face_buffer[2][raster::num_max_vertices][num_max_components],
+    math::real face_buffer[2][raster::num_max_vertices][num_max_components],
     uint32_t num_in_vertices,
     uint32_t num_components,
     uint32_t& num_out_vertices)
 {
     struct util
     {
-        static uint32_t clip_flag(const float* p)
+        static uint32_t clip_flag(const math::real* p)
         {
             enum
             {
@@ -33,7 +35,7 @@ uint32_t clip_face(
 
             uint32_t flag{ INSIDE };
 
-            if (p[3] < (float)clip_w_min) // w < w_min
+            if (p[3] < clip_w_min) // w < w_min
                 flag |= WMIN;
 
             if (p[0] < -p[3]) // x < -w
@@ -118,13 +120,13 @@ uint32_t clip_face(
             if (nv1 == clip_vertex_count[clip_face_in])
                 nv1 = 0;
 
-            float* v0{ face_buffer[clip_face_in][nv0] };
-            float* v1{ face_buffer[clip_face_in][nv1] };
+            math::real* v0{ face_buffer[clip_face_in][nv0] };
+            math::real* v1{ face_buffer[clip_face_in][nv1] };
 
             if (plane_in[nv0])
             {
                 uint32_t nv{ clip_vertex_count[clip_face_out] };
-                float* out{ face_buffer[clip_face_out][nv] };
+                math::real* out{ face_buffer[clip_face_out][nv] };
                 for (uint32_t nc{ 0 }; nc < num_components; ++nc)
                     out[nc] = v0[nc];
                 clip_flag[clip_face_out][nv] = clip_flag[clip_face_in][nv0];
@@ -177,7 +179,7 @@ uint32_t clip_face(
                 if (alpha > (clip_interp_type)0.0 && alpha < (clip_interp_type)1.0)
                 {
                     uint32_t nv{ clip_vertex_count[clip_face_out] };
-                    float* out{ face_buffer[clip_face_out][nv] };
+                    math::real* out{ face_buffer[clip_face_out][nv] };
                     const clip_interp_type k0{ (clip_interp_type)1.0 - alpha };
                     const clip_interp_type k1{ alpha };
                     for (uint32_t nc{ 0 }; nc < num_components; ++nc)
@@ -201,14 +203,61 @@ uint32_t clip_face(
     return clip_face_in;
 }
 
+// true if the first count elements are bitwise equal on all the face vertices
+bool uniform_attribute(
+    const float* data,
+    uint32_t stride,
+    uint32_t count,
+    uint32_t num_vertices)
+{
+    const float* v{ data + stride };
+    for (uint32_t nv{ 1 }; nv < num_vertices; ++nv)
+    {
+        if (std::memcmp(v, data, count * sizeof(float)) != 0)
+            return false;
+        v += stride;
+    }
+    return true;
+}
+
+// copy count pixels of step words from a frame piece to a row and back
+template<typename type>
+static void frame_load(type* dst, const type* src, uint32_t step, int32_t count)
+{
+    if (step == 1)
+        std::memcpy(dst, src, count * sizeof(type));
+    else
+        for (int32_t n{ 0 }; n < count; ++n, src += step)
+            dst[n] = *src;
+}
+
+template<typename type>
+static void frame_store(type* dst, const type* src, uint32_t step, int32_t count)
+{
+    if (step == 1)
+        std::memcpy(dst, src, count * sizeof(type));
+    else
+        for (int32_t n{ 0 }; n < count; ++n, dst += step)
+            *dst = src[n];
+}
+
 //------------------------------------------------------------------------------
 
 renderer::renderer()
 {
+    cpu::setup();
+
     raster_config.flags = 0;
     raster_config.vertex_count_data = raster_vertex_count_buffer;
     raster_config.vertex_data = raster_geometry_buffer;
     raster_config.back_cull = true;
+    raster_config.face_fill_color = nullptr;
+    raster_config.custom_raster = nullptr;
+    raster_config.occlusion = nullptr;
+    raster_config.frame_blocked = false;
+    raster_config.pixel_step = 1;
+    occlusion_config.frame_blocked = false;
+    occlusion_config.pixel_step = 1;
 }
 
 renderer::~renderer()
@@ -224,19 +273,87 @@ void renderer::set_frame_data(
     float* depth,
     raster::ARGB* frame)
 {
+    set_frame_buffers(width, height, stride, depth, frame, 1);
+}
+
+#if defined(USE_FRAME_INTERLEAVED)
+void renderer::set_frame_interleaved(
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    raster::depth_ARGB* data)
+{
+    set_frame_buffers(width, height, stride, data ? &data->depth : nullptr, data ? &data->color : nullptr, 2);
+}
+#endif
+
+void renderer::set_frame_buffers(
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    float* depth,
+    raster::ARGB* frame,
+    uint32_t step)
+{
+    pipeline_drain();
+
+    // pending clears belong to the previous buffers
+    bool same_size{ width == frame_width && height == frame_height && stride == frame_stride && step == pixel_step };
+    bool same_depth{ same_size && depth == frame_depth };
+    fast_clear_apply(
+        (same_size && frame == frame_data ? 0 : raster::FAST_CLEAR_FRAME) |
+        (same_depth ? 0 : raster::FAST_CLEAR_DEPTH));
+
+    // the depth of the previous epochs is in the previous buffer
+    if (!same_depth)
+        depth_epoch = depth_epoch_count;
+    if (!same_size)
+        layer_valid = false;
+
     frame_width = width;
     frame_height = height;
     frame_stride = stride;
+    pixel_step = step;
     frame_depth = depth;
     frame_data = frame;
 
+    raster_config.frame_width = frame_width;
+    raster_config.frame_height = frame_height;
     raster_config.frame_stride = frame_stride;
+    raster_config.pixel_step = pixel_step;
+    raster_config.depth_tile_stride = (frame_width + raster::depth_tile_width - 1) >> raster::depth_tile_shift;
     raster_config.depth_buffer = frame_depth;
     raster_config.frame_buffer = frame_data;
 
     occlusion_config.frame_width = width;
     occlusion_config.frame_height = height;
+    occlusion_config.frame_stride = stride;
+    occlusion_config.pixel_step = step;
     occlusion_config.depth_buffer = depth;
+
+    fast_clear_setup();
+    bin_setup();
+}
+
+void renderer::set_frame_blocked(bool blocked)
+{
+    if (blocked == frame_blocked)
+        return;
+    if (bin)
+        bin_flush(false);
+    pipeline_drain();
+
+    // the content of the buffers is in the previous layout
+    fast_clear_apply(raster::FAST_CLEAR_FRAME | raster::FAST_CLEAR_DEPTH);
+    depth_epoch = depth_epoch_count;
+    occlusion_valid = false;
+    raster_config.occlusion = nullptr;
+    layer_valid = false;
+
+    frame_blocked = blocked;
+    raster_config.frame_blocked = blocked;
+    occlusion_config.frame_blocked = blocked;
+    fast_clear_setup();
 }
 
 void renderer::set_frame_clear_color(raster::ARGB color)
@@ -249,9 +366,98 @@ void renderer::set_frame_clear_depth(float depth)
     frame_clear_depth = depth;
 }
 
+void renderer::set_frame_coverage(
+    raster::coverage_span* spans,
+    uint32_t* count,
+    uint32_t line_capacity)
+{
+    raster_config.coverage_spans = spans;
+    raster_config.coverage_count = count;
+    raster_config.coverage_line_capacity = line_capacity;
+}
+
+void renderer::set_frame_depth_tile(float* data)
+{
+    raster_config.depth_tile = data;
+    layer_valid = false;
+}
+
+void renderer::set_frame_fast_clear(uint8_t* flags)
+{
+    fast_clear_apply(raster::FAST_CLEAR_FRAME | raster::FAST_CLEAR_DEPTH);
+    fast_clear.flags = flags;
+    fast_clear.pending = 0;
+    fast_clear_setup();
+    if (flags)
+        std::memset(flags, 0, fast_clear.tile_w * fast_clear.tile_h);
+    raster_config.fast_clear = flags ? &fast_clear : nullptr;
+}
+
+void renderer::set_frame_bin(bin_buffer* bins, uint32_t tile_size, bool store_depth)
+{
+    if (bin)
+        bin_flush(false);
+    fast_clear_apply(raster::FAST_CLEAR_FRAME | raster::FAST_CLEAR_DEPTH);
+    bin = bins;
+    bin_store_depth = store_depth;
+    bin_tile_setting = tile_size;
+    bin_band_height = 0;
+    bin_band_callback = nullptr;
+    bin_band_user = nullptr;
+    bin_setup();
+}
+
+void renderer::set_frame_band(bin_buffer* bins, uint32_t band_height, band_callback callback, void* user)
+{
+    if (bin)
+        bin_flush(false);
+    fast_clear_apply(raster::FAST_CLEAR_FRAME | raster::FAST_CLEAR_DEPTH);
+    bin = bins;
+    bin_store_depth = false;
+    bin_band_height = band_height;
+    bin_band_callback = bins ? callback : nullptr;
+    bin_band_user = user;
+    bin_setup();
+}
+
+void renderer::set_frame_pipeline(raster_batch* batches, uint32_t count)
+{
+    pipeline_drain();
+    pipeline_batch = batches;
+
+    auto consume = [](void* p, uint32_t slot)
+    {
+        renderer& r{ *static_cast<renderer*>(p) };
+        r.prof_raster.start();
+        raster::scan_faces(&r.pipeline_batch[slot].config);
+        r.prof_raster.stop();
+    };
+    raster_pipeline.setup(batches ? count : 0, consume, this);
+    if (raster_pipeline.get_capacity() == 0)
+        pipeline_batch = nullptr;
+}
+
+void renderer::set_frame_layer(raster::ARGB* color, float* depth, float* depth_tile)
+{
+    layer_color = color;
+    layer_depth = depth;
+    layer_depth_tile = depth_tile;
+    layer_valid = false;
+}
+
+void renderer::set_frame_depth_epoch(uint32_t count, float range)
+{
+    depth_epoch_count = count;
+    depth_epoch_range = range;
+    layer_valid = false;
+    depth_epoch = count; // the next render_clear_depth clears
+    depth_epoch_update();
+}
+
 void renderer::set_frame_transform(math::mat4x4 matrix)
 {
-    math::trn4x4(post_matrix_t, matrix);
+    math::trn4x4(frame_matrix_t, matrix);
+    depth_epoch_update();
 }
 
 //------------------------------------------------------------------------------
@@ -300,7 +506,9 @@ void renderer::set_geometry_face_index(uint32_t* data, uint32_t count)
 
 void renderer::set_geometry_transform(math::mat4x4 matrix)
 {
-    math::trn4x4(pre_matrix_t, matrix);
+    math::mat4x4 matrix_t;
+    math::trn4x4(matrix_t, matrix);
+    math::to_real(pre_matrix_t, matrix_t, 16);
 }
 
 void renderer::set_geometry_back_cull(bool back_cull)
@@ -308,6 +516,17 @@ void renderer::set_geometry_back_cull(bool back_cull)
     raster_config.back_cull = back_cull;
 }
 
+void renderer::set_geometry_occlusion_cull(bool occlusion_cull)
+{
+    geometry_occlusion_cull = occlusion_cull;
+}
+
+void renderer::set_geometry_parallel(geometry_stage* stages, uint32_t count)
+{
+    geometry_stage_data = count ? stages : nullptr;
+    geometry_stage_count = count;
+}
+
 //------------------------------------------------------------------------------
 
 void renderer::set_fill_type(uint32_t setting)
@@ -357,6 +576,11 @@ void renderer::set_fill_texture(
     raster_config.texture_data = texture_data;
 }
 
+void renderer::set_fill_custom(raster::custom_raster_factory factory)
+{
+    raster_config.custom_raster = factory;
+}
+
 void renderer::set_shade_color(raster::ARGB color)
 {
     raster_config.shade_color = color;
@@ -374,49 +598,205 @@ void renderer::set_shade_lightmap(
 
 //------------------------------------------------------------------------------
 
-void renderer::render_begin()
+void renderer::set_thread_count(uint32_t count)
 {
+    thread_pool.set_count(count);
+}
+
+uint32_t renderer::get_thread_count()
+{
+    return thread_pool.get_count();
+}
 
+//------------------------------------------------------------------------------
+
+void renderer::render_begin()
+{
+    occlusion_cull_count = 0;
 }
 
 void renderer::render_end()
 {
+    pipeline_drain();
+    if (bin)
+        bin_flush(true);
 
+    // the depth of the tiles not drawn stays pending, it is not shown
+    prof_raster.start();
+    fast_clear_apply(raster::FAST_CLEAR_FRAME);
+    prof_raster.stop();
 }
 
 void renderer::render_clear_frame()
 {
+    clear(true, false);
+}
+
+void renderer::render_clear_depth()
+{
+    clear(false, true);
+}
+
+void renderer::render_clear()
+{
+    clear(true, true);
+}
+
+void renderer::render_clear_rect(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, bool clear_frame, bool clear_depth)
+{
+    pipeline_drain();
+    if (bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+
+    x1 = math::min(x1, frame_width);
+    y1 = math::min(y1, frame_height);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
     prof_raster.start();
 
-    raster::ARGB color{ frame_clear_color };
-    raster::ARGB* p{ frame_data };
-    uint32_t width{ frame_width };
-    uint32_t jump{ frame_stride - frame_width };
-    for (uint32_t row{ 0 }; row < frame_height; ++row)
+    // pending fast clears of the tiles are older
+    if (fast_clear.flags)
+    {
+        uint32_t mask{ (clear_frame ? (uint32_t)raster::FAST_CLEAR_FRAME : 0u) | (clear_depth ? (uint32_t)raster::FAST_CLEAR_DEPTH : 0u) };
+        int32_t tx0{ (int32_t)(x0 >> raster::fast_clear_tile_shift) };
+        int32_t tx1{ (int32_t)(((x1 - 1) >> raster::fast_clear_tile_shift) + 1) };
+        for (uint32_t ty{ y0 >> raster::fast_clear_tile_shift }; ty <= ((y1 - 1) >> raster::fast_clear_tile_shift); ++ty)
+            raster::fast_clear_tiles(fast_clear, tx0, tx1, (int32_t)ty, mask);
+    }
+
+    clear_buffers(x0, y0, x1, y1, clear_frame, clear_depth);
+
+    if (clear_depth)
     {
-        uint32_t n{ width };
-        while (n--)
-            *p++ = color;
-        p += jump;
+        // the mipchain is rebuilt, coverage of the rows is dropped, depth tiles keep
+        // a conservative range
+        occlusion_valid = false;
+        raster_config.occlusion = nullptr;
+        if (raster_config.coverage_spans)
+            for (uint32_t row{ y0 }; row < y1; ++row)
+                raster_config.coverage_count[row] = 0;
+        if (raster_config.depth_tile)
+        {
+            uint32_t tx0{ x0 >> raster::depth_tile_shift };
+            uint32_t tx1{ ((x1 - 1) >> raster::depth_tile_shift) + 1 };
+            for (uint32_t row{ y0 }; row < y1; ++row)
+            {
+                float* t{ &raster_config.depth_tile[(raster_config.depth_tile_stride * row + tx0) * 2] };
+                for (uint32_t tx{ tx0 }; tx < tx1; ++tx, t += 2)
+                {
+                    bool full{ (tx << raster::depth_tile_shift) >= x0 && ((tx + 1) << raster::depth_tile_shift) <= x1 };
+                    t[0] = full ? frame_clear_depth : math::depth_min(t[0], frame_clear_depth);
+                    t[1] = full ? frame_clear_depth : math::depth_max(t[1], frame_clear_depth);
+                }
+            }
+        }
     }
 
     prof_raster.stop();
 }
 
-void renderer::render_clear_depth()
+void renderer::render_store_layer(uint32_t version)
+{
+    if (layer_color == nullptr || bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+    pipeline_drain();
+    fast_clear_apply(raster::FAST_CLEAR_FRAME | raster::FAST_CLEAR_DEPTH);
+
+    prof_raster.start();
+
+    // whole buffers, the blocked padding included
+    uint32_t rows{ frame_blocked ? (frame_height + raster::frame_block_height - 1) & ~(raster::frame_block_height - 1) : frame_height };
+    int32_t count{ (int32_t)(frame_stride * rows) };
+    frame_load(reinterpret_cast<uint32_t*>(layer_color), reinterpret_cast<const uint32_t*>(frame_data), pixel_step, count);
+    frame_load(layer_depth, frame_depth, pixel_step, count);
+    if (layer_depth_tile && raster_config.depth_tile)
+        std::memcpy(layer_depth_tile, raster_config.depth_tile, frame_height * raster_config.depth_tile_stride * 2 * sizeof(float));
+
+    layer_valid = true;
+    layer_version = version;
+    layer_depth_epoch = depth_epoch;
+
+    prof_raster.stop();
+}
+
+bool renderer::render_load_layer(uint32_t version)
+{
+    if (!layer_valid || version != layer_version || bin_band_callback)
+        return false;
+    if (bin)
+        bin_flush(false);
+    pipeline_drain();
+
+    // the layer replaces the pending clears
+    if (fast_clear.flags)
+    {
+        std::memset(fast_clear.flags, 0, fast_clear.tile_w * fast_clear.tile_h);
+        fast_clear.pending = 0;
+    }
+    bin_clear_frame = false;
+    bin_clear_depth = false;
+
+    // the layer depth is in the range of its epoch
+    if (depth_epoch != layer_depth_epoch)
+    {
+        depth_epoch = layer_depth_epoch;
+        depth_epoch_update();
+    }
+
+    occlusion_valid = false;
+    raster_config.occlusion = nullptr;
+    if (!bin && raster_config.coverage_spans)
+        for (uint32_t row{ 0 }; row < frame_height; ++row)
+            raster_config.coverage_count[row] = 0;
+
+    prof_raster.start();
+
+    uint32_t rows{ frame_blocked ? (frame_height + raster::frame_block_height - 1) & ~(raster::frame_block_height - 1) : frame_height };
+    int32_t count{ (int32_t)(frame_stride * rows) };
+    frame_store(reinterpret_cast<uint32_t*>(frame_data), reinterpret_cast<const uint32_t*>(layer_color), pixel_step, count);
+    frame_store(frame_depth, layer_depth, pixel_step, count);
+
+    // without stored tiles the depth tiles take the widest range
+    if (raster_config.depth_tile)
+    {
+        uint32_t tile_count{ frame_height * raster_config.depth_tile_stride * 2 };
+        if (layer_depth_tile)
+            std::memcpy(raster_config.depth_tile, layer_depth_tile, tile_count * sizeof(float));
+        else
+            for (uint32_t n{ 0 }; n < tile_count; n += 2)
+            {
+                raster_config.depth_tile[n] = -FLT_MAX;
+                raster_config.depth_tile[n + 1] = FLT_MAX;
+            }
+    }
+
+    prof_raster.stop();
+    return true;
+}
+
+void renderer::render_resolve_frame(raster::ARGB* dst, uint32_t dst_stride)
 {
+    if (bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+    pipeline_drain();
+    fast_clear_apply(raster::FAST_CLEAR_FRAME);
+
     prof_raster.start();
 
-    float depth{ frame_clear_depth };
-    float* p{ frame_depth };
-    uint32_t width{ frame_width };
-    uint32_t jump{ frame_stride - frame_width };
     for (uint32_t row{ 0 }; row < frame_height; ++row)
     {
-        uint32_t n{ width };
-        while (n--)
-            *p++ = depth;
-        p += jump;
+        raster::ARGB* dst_row{ &dst[dst_stride * row] };
+        raster::frame_row_pieces(frame_blocked, frame_stride, 0, frame_width, row, [&](int32_t offset, int32_t x, int32_t count)
+        {
+            frame_load(&dst_row[x], &frame_data[offset * pixel_step], pixel_step, count);
+        });
     }
 
     prof_raster.stop();
@@ -434,7 +814,8 @@ void renderer::render_draw()
         uint32_t count; // sequential elements to read
         uint32_t stride; // stride
     };
-    data_source geometry_source[3];
+    static constexpr uint32_t geometry_source_max_count{ 4 };
+    data_source geometry_source[geometry_source_max_count];
     uint32_t geometry_source_count{ 1 };
     uint32_t attribute_count{ 0 };
 
@@ -463,8 +844,31 @@ void renderer::render_draw()
         source.stride = geometry_tex_coord_stride;
         attribute_count += 2;
     }
+    else
+    if ((raster_config.flags & raster::FILL_BIT_MASK) == raster::FILL_CUSTOM)
+    {
+        assert(geometry_tex_coord_data);
+        assert(geometry_tex_coord_stride >= 2);
+        assert(geometry_color_data);
+        assert(geometry_color_stride >= 4);
+        data_source& source_tex_coord{ geometry_source[geometry_source_count++] };
+        source_tex_coord.data = geometry_tex_coord_data;
+        source_tex_coord.count = 2;
+        source_tex_coord.stride = geometry_tex_coord_stride;
+        attribute_count += 2;
+        data_source& source_color{ geometry_source[geometry_source_count++] };
+        source_color.data = geometry_color_data;
+        source_color.count = 4;
+        source_color.stride = geometry_color_stride;
+        attribute_count += 4;
+    }
+
+    // shade is part of the custom pixel functor
+    uint32_t shade_type{ raster_config.flags & raster::SHADE_BIT_MASK };
+    if ((raster_config.flags & raster::FILL_BIT_MASK) == raster::FILL_CUSTOM)
+        shade_type = raster::SHADE_NONE;
 
-    if ((raster_config.flags & raster::SHADE_BIT_MASK) == raster::SHADE_VERTEX)
+    if (shade_type == raster::SHADE_VERTEX)
     {
         assert(geometry_light_color_data);
         assert(geometry_light_color_stride >= 3);
@@ -475,7 +879,7 @@ void renderer::render_draw()
         attribute_count += 3;
     }
     else
-    if ((raster_config.flags & raster::SHADE_BIT_MASK) == raster::SHADE_LIGHTMAP)
+    if (shade_type == raster::SHADE_LIGHTMAP)
     {
         assert(geometry_lmap_coord_data);
         assert(geometry_lmap_coord_stride >= 2);
@@ -485,46 +889,167 @@ void renderer::render_draw()
         source.stride = geometry_lmap_coord_stride;
         attribute_count += 2;
     }
+    else
+    if (shade_type == raster::SHADE_VERTEX_LIGHTMAP)
+    {
+        assert((raster_config.flags & raster::FILL_BIT_MASK) == raster::FILL_TEXTURE);
+        assert(geometry_light_color_data);
+        assert(geometry_light_color_stride >= 3);
+        assert(geometry_lmap_coord_data);
+        assert(geometry_lmap_coord_stride >= 2);
+        data_source& source_light_color{ geometry_source[geometry_source_count++] };
+        source_light_color.data = geometry_light_color_data;
+        source_light_color.count = 3;
+        source_light_color.stride = geometry_light_color_stride;
+        attribute_count += 3;
+        data_source& source_lmap_coord{ geometry_source[geometry_source_count++] };
+        source_lmap_coord.data = geometry_lmap_coord_data;
+        source_lmap_coord.count = 2;
+        source_lmap_coord.stride = geometry_lmap_coord_stride;
+        attribute_count += 2;
+    }
 
     uint32_t component_count{ 4 + attribute_count };
 
+    // faces with uniform vertex color and/or vertex light are drawn with
+    // FILL_SOLID rasters, the constant is folded in a per face fill color
+    // and the uniform components (right after x y z w) are not staged
+
+    uint32_t fill_type{ raster_config.flags & raster::FILL_BIT_MASK };
+    bool flat_color{ fill_type == raster::FILL_VERTEX };
+    bool flat_light{ shade_type == raster::SHADE_VERTEX &&
+        (fill_type == raster::FILL_VERTEX || fill_type == raster::FILL_SOLID) };
+
     // pre transform, clip, post transform
 
     face* faces{ geometry_face };
     uint32_t* face_index{ geometry_face_index };
     uint32_t face_count{ face_index ? geometry_face_index_count : geometry_face_count };
 
-    raster_config.vertex_stride = component_count;
+    bool occlusion_cull{ geometry_occlusion_cull && occlusion_valid };
+
+    // outline faces are not binned in tiles, they draw over the binned ones
+    // bands are full width, outline spans are not clipped in x
+    bool binning{ bin != nullptr && (fill_type != raster::FILL_OUTLINE || bin_band_callback) };
+    uint32_t bin_state{ UINT32_MAX };
+    if (bin != nullptr && !binning)
+        bin_flush(false);
+
+    // batches go to the raster thread, occlusion cull reads the depth it writes
+    bool pipelined{ pipeline_batch != nullptr && !binning && !occlusion_cull };
+    if (!pipelined)
+        pipeline_drain();
+
+    uint32_t flags{ raster_config.flags };
+    uint32_t batch_flags{ flags };
+    uint32_t batch_component_count{ component_count };
 
     raster_face_buffer_index = 0;
     raster_geometry_buffer_index = 0;
     //raster_geometry_vertex_index = 0;
 
-    for (uint32_t nf{ 0 }; nf < face_count; ++nf)
+    uint32_t* vertex_count_buffer{ raster_vertex_count_buffer };
+    raster::ARGB* face_color_buffer{ raster_face_color_buffer };
+    math::real* geometry_buffer{ raster_geometry_buffer };
+    uint32_t pipeline_slot{};
+    if (pipelined)
     {
-        face face_in{ faces[face_index ? face_index[nf] : nf] };
+        pipeline_slot = raster_pipeline.acquire();
+        vertex_count_buffer = pipeline_batch[pipeline_slot].vertex_count;
+        face_color_buffer = pipeline_batch[pipeline_slot].face_color;
+        geometry_buffer = pipeline_batch[pipeline_slot].vertex;
+    }
 
-        // check if there is enough free space in buffers
+    auto draw_buffer = [&]()
+    {
+        // draw current buffer content and reset buffers
 
-        uint32_t raster_face_buffer_free{ raster_face_buffer_size - raster_face_buffer_index };
-        uint32_t raster_geometry_buffer_free{ raster_geometry_buffer_size - raster_geometry_buffer_index };
-        if (raster_face_buffer_free < 1 || raster_geometry_buffer_free < (raster::num_max_vertices * component_count))
-        {
-            // draw current buffer content and reset buffers
+        raster_config.flags = batch_flags;
+        raster_config.num_faces = raster_face_buffer_index;
+        raster_config.vertex_stride = batch_component_count;
+        raster_config.face_fill_color = batch_flags != flags ? face_color_buffer : nullptr;
 
-            raster_config.num_faces = raster_face_buffer_index;
+        if (pipelined)
+        {
+            // submit and stage the next batch in a free slot
+            raster_batch& batch{ pipeline_batch[pipeline_slot] };
+            batch.config = raster_config;
+            batch.config.vertex_count_data = batch.vertex_count;
+            batch.config.vertex_data = batch.vertex;
+            raster_pipeline.submit();
 
+            prof_geometry.stop();
+            pipeline_slot = raster_pipeline.acquire();
+            prof_geometry.start();
+            vertex_count_buffer = pipeline_batch[pipeline_slot].vertex_count;
+            face_color_buffer = pipeline_batch[pipeline_slot].face_color;
+            geometry_buffer = pipeline_batch[pipeline_slot].vertex;
+        }
+        else
+        {
             prof_geometry.stop();
             prof_raster.start();
             raster::scan_faces(&raster_config);
             prof_raster.stop();
             prof_geometry.start();
+        }
+
+        raster_face_buffer_index = 0;
+        raster_geometry_buffer_index = 0;
+        //raster_geometry_vertex_index = 0;
+    };
+
+    // one face: uniform attributes, pre transform, clip, post transform, screen rect
+    // returns the buffer with the output face, nullptr if clipped
+    // reads shared state only, parallel geometry runs it on the workers
+
+    using vertex_buffer = math::real[raster::num_max_vertices][num_max_components];
+    bool face_rect{ occlusion_cull || binning };
+
+    auto process_face = [&](face face_in, vertex_buffer (&buffer)[2], stage_face& g) -> vertex_buffer*
+    {
+        // uniform attributes
+
+        uint32_t face_flags{ flags };
+        uint32_t face_drop_count{ 0 };
+        raster::ARGB face_color{ raster_config.fill_color };
+
+        bool face_flat_color{ flat_color && uniform_attribute(
+            &geometry_color_data[geometry_color_stride * face_in.index],
+            geometry_color_stride, 4, face_in.count) };
+        bool face_flat_light{ flat_light && (face_flat_color || !flat_color) && uniform_attribute(
+            &geometry_light_color_data[geometry_light_color_stride * face_in.index],
+            geometry_light_color_stride, 3, face_in.count) };
 
-            raster_face_buffer_index = 0;
-            raster_geometry_buffer_index = 0;
-            //raster_geometry_vertex_index = 0;
+        if (face_flat_color)
+        {
+            // same truncation as vertex color rasters
+            const float* color{ &geometry_color_data[geometry_color_stride * face_in.index] };
+            face_color.r = (uint8_t)math::clamp((int32_t)math::to_real(color[0]), (int32_t)0, (int32_t)255);
+            face_color.g = (uint8_t)math::clamp((int32_t)math::to_real(color[1]), (int32_t)0, (int32_t)255);
+            face_color.b = (uint8_t)math::clamp((int32_t)math::to_real(color[2]), (int32_t)0, (int32_t)255);
+            face_color.a = (uint8_t)math::clamp((int32_t)math::to_real(color[3]), (int32_t)0, (int32_t)255);
+            face_flags = (face_flags & ~raster::FILL_BIT_MASK) | raster::FILL_SOLID;
+            face_drop_count += 4;
+        }
+        if (face_flat_light)
+        {
+            // same 16.16 light scale as vertex shade rasters
+            const float* light{ &geometry_light_color_data[geometry_light_color_stride * face_in.index] };
+            uint32_t r{ (uint32_t)math::clamp((int32_t)(math::to_real(light[0]) * (math::real)0x10000), (int32_t)0, (int32_t)0x00FFFFFF) };
+            uint32_t g{ (uint32_t)math::clamp((int32_t)(math::to_real(light[1]) * (math::real)0x10000), (int32_t)0, (int32_t)0x00FFFFFF) };
+            uint32_t b{ (uint32_t)math::clamp((int32_t)(math::to_real(light[2]) * (math::real)0x10000), (int32_t)0, (int32_t)0x00FFFFFF) };
+            face_color.r = (uint8_t)((face_color.r * r) >> 24u);
+            face_color.g = (uint8_t)((face_color.g * g) >> 24u);
+            face_color.b = (uint8_t)((face_color.b * b) >> 24u);
+            face_flags = (face_flags & ~(raster::FILL_BIT_MASK | raster::SHADE_BIT_MASK)) | raster::FILL_SOLID | raster::SHADE_NONE;
+            face_drop_count += 3;
         }
 
+        g.flags = face_flags;
+        g.drop_count = (uint16_t)face_drop_count;
+        g.color = face_color;
+
         // pre transform face to render buffer
 
 #if 0
@@ -532,7 +1057,7 @@ void renderer::render_draw()
         {
             data_source& source{ geometry_source[0] };
             float* in{ &source.data[source.stride * face_in.index] };
-            float* out{ &render_buffer[0][0][nc] };
+            math::real* out{ &buffer[0][0][nc] };
             for (uint32_t nv{ 0 }; nv < face_in.count; ++nv)
             {
                 math::mul4x4t_3(out, pre_matrix_t, in);
@@ -545,7 +1070,7 @@ void renderer::render_draw()
         {
             data_source& source{ geometry_source[ns] };
             float* in{ &source.data[source.stride * face_in.index] };
-            float* out{ &render_buffer[0][0][nc] };
+            math::real* out{ &buffer[0][0][nc] };
             for (uint32_t nv{ 0 }; nv < face_in.count; ++nv)
             {
                 for (uint32_t n{ 0 }; n < source.count; ++n)
@@ -556,22 +1081,20 @@ void renderer::render_draw()
             nc += source.count;
         }
 #else
-        float* in[3]
-        {
-            &geometry_source[0].data[geometry_source[0].stride * face_in.index],
-            &geometry_source[1].data[geometry_source[1].stride * face_in.index],
-            &geometry_source[2].data[geometry_source[2].stride * face_in.index],
-        };
+        float* in[geometry_source_max_count];
+        for (uint32_t ns{ 0 }; ns < geometry_source_count; ++ns)
+            in[ns] = &geometry_source[ns].data[geometry_source[ns].stride * face_in.index];
         for (uint32_t nv{ 0 }; nv < face_in.count; ++nv)
         {
-            float* out{ render_buffer[0][nv] };
-            math::mul4x4t_3(out, pre_matrix_t, in[0]);
+            math::real* out{ buffer[0][nv] };
+            math::real coord[3]{ math::to_real(in[0][0]), math::to_real(in[0][1]), math::to_real(in[0][2]) };
+            math::mul4x4t_3(out, pre_matrix_t, coord);
             in[0] += geometry_source[0].stride;
             out += 4;
             for (uint32_t ns{ 1 }; ns < geometry_source_count; ++ns)
             {
                 for (uint32_t n{ 0 }; n < geometry_source[ns].count; ++n)
-                    out[n] = in[ns][n];
+                    out[n] = math::to_real(in[ns][n]);
                 in[ns] += geometry_source[ns].stride;
                 out += geometry_source[ns].count;
             }
@@ -581,21 +1104,21 @@ void renderer::render_draw()
         // clip
 
         uint32_t num_out_vertices;
-        uint32_t buffer_index{ clip_face(render_buffer, face_in.count, component_count, num_out_vertices) };
+        uint32_t buffer_index{ clip_face(buffer, face_in.count, component_count, num_out_vertices) };
         if (num_out_vertices < 3)
-            continue;
+            return nullptr;
 
-        float (&clip_buffer)[raster::num_max_vertices][num_max_components]{ render_buffer[buffer_index] };
+        vertex_buffer& clip_buffer{ buffer[buffer_index] };
 
         // post transform
 
-        math::vec4 res;
+        math::real res[4];
         for (uint32_t nv{ 0 }; nv < num_out_vertices; ++nv)
         {
-            float* out{ clip_buffer[nv] };
+            math::real* out{ clip_buffer[nv] };
             math::mul4x4t_4(res, post_matrix_t, out);
             assert(res[3] != 0.f);
-            float winv{ 1.f / res[3] };
+            math::real winv{ 1.f / res[3] };
             out[0] = res[0] * winv;
             out[1] = res[1] * winv;
             out[2] = res[2] * winv;
@@ -603,27 +1126,425 @@ void renderer::render_draw()
             for (uint32_t n{ 4 }; n < component_count; ++n)
                 out[n] *= winv;
         }
+        g.vertex_count = (uint16_t)num_out_vertices;
 
-        // add to raster buffer
+        // screen rect and nearest depth
 
-        raster_vertex_count_buffer[raster_face_buffer_index++] = num_out_vertices;
+        if (face_rect)
+        {
+            math::real screen_min[2]{ clip_buffer[0][0], clip_buffer[0][1] };
+            math::real screen_max[2]{ clip_buffer[0][0], clip_buffer[0][1] };
+            math::real depth_min{ clip_buffer[0][2] };
+            for (uint32_t nv{ 1 }; nv < num_out_vertices; ++nv)
+            {
+                screen_min[0] = math::min(screen_min[0], clip_buffer[nv][0]);
+                screen_min[1] = math::min(screen_min[1], clip_buffer[nv][1]);
+                screen_max[0] = math::max(screen_max[0], clip_buffer[nv][0]);
+                screen_max[1] = math::max(screen_max[1], clip_buffer[nv][1]);
+                depth_min = math::min(depth_min, clip_buffer[nv][2]);
+            }
+            g.rect_min[0] = math::to_float(screen_min[0]);
+            g.rect_min[1] = math::to_float(screen_min[1]);
+            g.rect_max[0] = math::to_float(screen_max[0]);
+            g.rect_max[1] = math::to_float(screen_max[1]);
+            g.rect_depth = math::to_float(depth_min);
+        }
 
-        float* out{ &raster_geometry_buffer[raster_geometry_buffer_index] };
-        for (uint32_t nv{ 0 }; nv < num_out_vertices; ++nv)
-            for (uint32_t nc{ 0 }; nc < component_count; ++nc)
+        return &clip_buffer;
+    };
+
+    // x y z w and the non uniform components
+
+    auto store_vertices = [&](math::real* out, const vertex_buffer& clip_buffer, const stage_face& g)
+    {
+        for (uint32_t nv{ 0 }; nv < g.vertex_count; ++nv)
+        {
+            for (uint32_t nc{ 0 }; nc < 4; ++nc)
+                *out++ = clip_buffer[nv][nc];
+            for (uint32_t nc{ 4u + g.drop_count }; nc < component_count; ++nc)
                 *out++ = clip_buffer[nv][nc];
-        raster_geometry_buffer_index += num_out_vertices * component_count;
+        }
+    };
+
+    // add a visible face in submission order to the bins or the raster buffer
+    // returns the space for its vertex components, nullptr if the face is dropped
+
+    auto add_face = [&](const stage_face& g) -> math::real*
+    {
+        uint32_t vertex_stride{ component_count - g.drop_count };
+
+        if (binning)
+        {
+            // tiles of the pixels around the screen rect
+            int32_t tile_rect[4]
+            {
+                math::max((int32_t)math::to_real(g.rect_min[0]), (int32_t)0) / (int32_t)bin_tile_width,
+                math::max((int32_t)math::to_real(g.rect_min[1]), (int32_t)0) / (int32_t)bin_tile_height,
+                math::min((int32_t)math::to_real(g.rect_max[0]) / (int32_t)bin_tile_width + 1, (int32_t)bin_tile_count[0]),
+                math::min((int32_t)math::to_real(g.rect_max[1]) / (int32_t)bin_tile_height + 1, (int32_t)bin_tile_count[1])
+            };
+            if (tile_rect[0] >= tile_rect[2] || tile_rect[1] >= tile_rect[3])
+                return nullptr;
+
+            uint32_t vertex_size{ g.vertex_count * vertex_stride };
+            uint32_t tile_face_count{ (uint32_t)((tile_rect[2] - tile_rect[0]) * (tile_rect[3] - tile_rect[1])) };
+            if (bin_face_count == bin->face_capacity ||
+                bin_vertex_count + vertex_size > bin->vertex_capacity ||
+                bin_tile_face_count + tile_face_count > bin->tile_face_capacity ||
+                (bin_state == UINT32_MAX && bin_state_count == bin->state_capacity))
+            {
+                // bands are drawn once per frame, the face is dropped
+                assert(!bin_band_callback);
+                if (bin_band_callback)
+                    return nullptr;
+                prof_geometry.stop();
+                bin_flush(false);
+                prof_geometry.start();
+                bin_state = UINT32_MAX;
+            }
+            assert(tile_face_count <= bin->tile_face_capacity);
+            if (bin_state == UINT32_MAX)
+            {
+                bin_state = bin_state_count++;
+                bin->state[bin_state] = raster_config;
+            }
+
+            bin_face& f{ bin->face[bin_face_count++] };
+            f.state = bin_state;
+            f.flags = g.flags;
+            f.vertex_index = bin_vertex_count;
+            f.vertex_count = g.vertex_count;
+            f.vertex_stride = (uint16_t)vertex_stride;
+            f.color = g.color;
+            for (uint32_t n{ 0 }; n < 4; ++n)
+                f.tile_rect[n] = (uint16_t)tile_rect[n];
+
+            math::real* out{ &bin->vertex[bin_vertex_count] };
+            bin_vertex_count += vertex_size;
+
+            for (int32_t ty{ tile_rect[1] }; ty < tile_rect[3]; ++ty)
+                for (int32_t tx{ tile_rect[0] }; tx < tile_rect[2]; ++tx)
+                    bin->tile_face_offset[bin_tile_count[0] * ty + tx]++;
+            bin_tile_face_count += tile_face_count;
+            return out;
+        }
+
+        // check if there is enough free space in buffers, draw in order on raster change
+
+        uint32_t raster_face_buffer_free{ raster_face_buffer_size - raster_face_buffer_index };
+        uint32_t raster_geometry_buffer_free{ raster_geometry_buffer_size - raster_geometry_buffer_index };
+        if (raster_face_buffer_free < 1 || raster_geometry_buffer_free < (raster::num_max_vertices * component_count) ||
+            (g.flags != batch_flags && raster_face_buffer_index))
+            draw_buffer();
+
+        batch_flags = g.flags;
+        batch_component_count = vertex_stride;
+
+        face_color_buffer[raster_face_buffer_index] = g.color;
+        vertex_count_buffer[raster_face_buffer_index++] = g.vertex_count;
+
+        math::real* out{ &geometry_buffer[raster_geometry_buffer_index] };
+        raster_geometry_buffer_index += g.vertex_count * vertex_stride;
+        return out;
+    };
+
+    bool parallel{ geometry_stage_data != nullptr && thread_pool.get_count() > 1 };
+    if (!parallel)
+    {
+        for (uint32_t nf{ 0 }; nf < face_count; ++nf)
+        {
+            stage_face g;
+            vertex_buffer* clip_buffer{ process_face(faces[face_index ? face_index[nf] : nf], render_buffer, g) };
+            if (!clip_buffer)
+                continue;
+
+            // against the hierarchical z-buffer
+
+            if (occlusion_cull)
+            {
+                raster::occlusion_update_mipchain(occlusion_config, occlusion_data);
+                if (raster::occlusion_test_rect(occlusion_config, occlusion_data,
+                    g.rect_min, g.rect_max, g.rect_depth))
+                {
+                    occlusion_cull_count++;
+                    continue;
+                }
+            }
+
+            math::real* out{ add_face(g) };
+            if (out)
+                store_vertices(out, *clip_buffer, g);
+        }
+    }
+    else
+    {
+        // workers process one chunk of faces per stage, then the stages are added
+        // in submission order, the hierarchical z-buffer is updated once per round
+
+        uint32_t chunk_size{ math::min(geometry_stage_data[0].face_capacity,
+            geometry_stage_data[0].vertex_capacity / (raster::num_max_vertices * component_count)) };
+        assert(chunk_size > 0);
+
+        auto process_chunk = [&](uint32_t chunk, uint32_t first)
+        {
+            geometry_stage& stage{ geometry_stage_data[chunk] };
+            uint32_t last{ math::min(first + chunk_size, face_count) };
+            vertex_buffer buffer[2];
+            math::real* out{ stage.vertex };
+            stage.face_count = 0;
+            stage.cull_count = 0;
+            for (uint32_t nf{ first }; nf < last; ++nf)
+            {
+                stage_face& g{ stage.face[stage.face_count] };
+                vertex_buffer* clip_buffer{ process_face(faces[face_index ? face_index[nf] : nf], buffer, g) };
+                if (!clip_buffer)
+                    continue;
+                if (occlusion_cull && raster::occlusion_test_rect(occlusion_config, occlusion_data,
+                    g.rect_min, g.rect_max, g.rect_depth))
+                {
+                    stage.cull_count++;
+                    continue;
+                }
+                store_vertices(out, *clip_buffer, g);
+                out += g.vertex_count * (component_count - g.drop_count);
+                stage.face_count++;
+            }
+        };
+
+        struct chunk_data
+        {
+            decltype(process_chunk)* process;
+            thread::work_queue queue;
+            uint32_t first;
+            uint32_t size;
+        };
+        auto chunk_job = [](void* p, uint32_t worker)
+        {
+            chunk_data& d{ *static_cast<chunk_data*>(p) };
+            uint32_t chunk;
+            while (d.queue.next(worker, chunk))
+                (*d.process)(chunk, d.first + chunk * d.size);
+        };
+
+        chunk_data data;
+        data.process = &process_chunk;
+        data.size = chunk_size;
+        for (uint32_t first{ 0 }; first < face_count; first += chunk_size * geometry_stage_count)
+        {
+            uint32_t chunk_count{ math::min(geometry_stage_count, (face_count - first + chunk_size - 1) / chunk_size) };
+            if (occlusion_cull)
+                raster::occlusion_update_mipchain(occlusion_config, occlusion_data);
+            data.first = first;
+            data.queue.setup(chunk_count, thread_pool.get_count());
+            thread_pool.run(chunk_job, &data);
+
+            for (uint32_t chunk{ 0 }; chunk < chunk_count; ++chunk)
+            {
+                const geometry_stage& stage{ geometry_stage_data[chunk] };
+                const math::real* in{ stage.vertex };
+                occlusion_cull_count += stage.cull_count;
+                for (uint32_t n{ 0 }; n < stage.face_count; ++n)
+                {
+                    const stage_face& g{ stage.face[n] };
+                    uint32_t vertex_size{ g.vertex_count * (component_count - g.drop_count) };
+                    math::real* out{ add_face(g) };
+                    if (out)
+                        std::memcpy(out, in, vertex_size * sizeof(math::real));
+                    in += vertex_size;
+                }
+            }
+        }
     }
 
     // draw remaining buffer content
 
     if (raster_face_buffer_index)
+        draw_buffer();
+
+    raster_config.flags = flags;
+    raster_config.vertex_stride = component_count;
+    raster_config.face_fill_color = nullptr;
+
+    prof_geometry.stop();
+}
+
+void renderer::render_sprites(const sprite* sprites, uint32_t count)
+{
+    pipeline_drain();
+    if (bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+
+    prof_geometry.start();
+
+    while (count)
     {
-        raster_config.num_faces = raster_face_buffer_index;
+        uint32_t batch_count{ math::min(count, raster_sprite_buffer_size) };
+        count -= batch_count;
+
+        raster::sprite* out{ raster_sprite_buffer };
+        for (uint32_t n{ 0 }; n < batch_count; ++n)
+        {
+            const sprite& in{ *sprites++ };
+            math::real center[2]{ math::to_real(in.center[0]), math::to_real(in.center[1]) };
+            math::real half_width{ math::to_real(in.size[0]) * 0.5f };
+            math::real half_height{ math::to_real(in.size[1]) * 0.5f };
+            out->x0 = center[0] - half_width;
+            out->y0 = center[1] - half_height;
+            out->x1 = center[0] + half_width;
+            out->y1 = center[1] + half_height;
+            out->depth = math::to_real(in.depth) + math::to_real(depth_epoch_offset);
+            out->s0 = math::to_real(in.tex_rect[0]);
+            out->t0 = math::to_real(in.tex_rect[1]);
+            out->s1 = math::to_real(in.tex_rect[2]);
+            out->t1 = math::to_real(in.tex_rect[3]);
+            out->color = in.color;
+            out++;
+        }
+
+        prof_geometry.stop();
+        prof_raster.start();
+        raster::scan_sprites(&raster_config, raster_sprite_buffer, batch_count);
+        prof_raster.stop();
+        prof_geometry.start();
+    }
+
+    prof_geometry.stop();
+}
 
+void renderer::render_depth_image(const raster::depth_image& image, const sprite& sp)
+{
+    pipeline_drain();
+    if (bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+
+    math::real center[2]{ math::to_real(sp.center[0]), math::to_real(sp.center[1]) };
+    math::real half_width{ math::to_real(sp.size[0]) * 0.5f };
+    math::real half_height{ math::to_real(sp.size[1]) * 0.5f };
+    raster::sprite out;
+    out.x0 = center[0] - half_width;
+    out.y0 = center[1] - half_height;
+    out.x1 = center[0] + half_width;
+    out.y1 = center[1] + half_height;
+    out.depth = math::to_real(sp.depth) + math::to_real(depth_epoch_offset);
+    out.s0 = math::to_real(sp.tex_rect[0]);
+    out.t0 = math::to_real(sp.tex_rect[1]);
+    out.s1 = math::to_real(sp.tex_rect[2]);
+    out.t1 = math::to_real(sp.tex_rect[3]);
+    out.color = sp.color;
+
+    prof_raster.start();
+    raster::scan_depth_image(&raster_config, image, out);
+    prof_raster.stop();
+}
+
+void renderer::render_particles(particle::buffer& particles)
+{
+    pipeline_drain();
+    if (bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+
+    prof_geometry.start();
+
+    // pixels per world unit at w = 1, from the x and y rows of the pre transform
+
+    math::real scale_x{ math::sqrt(
+        pre_matrix_t[0] * pre_matrix_t[0] +
+        pre_matrix_t[4] * pre_matrix_t[4] +
+        pre_matrix_t[8] * pre_matrix_t[8]) * math::abs(post_matrix_t[0]) };
+    math::real scale_y{ math::sqrt(
+        pre_matrix_t[1] * pre_matrix_t[1] +
+        pre_matrix_t[5] * pre_matrix_t[5] +
+        pre_matrix_t[9] * pre_matrix_t[9]) * math::abs(post_matrix_t[5]) };
+
+    auto project = [&](uint32_t n, raster::sprite& out) -> bool
+    {
+        math::real coord[3]
+        {
+            math::to_real(particles.position[0][n]),
+            math::to_real(particles.position[1][n]),
+            math::to_real(particles.position[2][n])
+        };
+        math::real clip[4];
+        math::mul4x4t_3(clip, pre_matrix_t, coord);
+        if (clip[3] < clip_w_min)
+            return false;
+        math::real res[4];
+        math::mul4x4t_4(res, post_matrix_t, clip);
+        math::real winv{ 1.f / res[3] };
+        math::real x{ res[0] * winv };
+        math::real y{ res[1] * winv };
+        math::real half_size{ math::to_real(particles.size[n]) * 0.5f * winv };
+        math::real half_width{ half_size * scale_x };
+        math::real half_height{ half_size * scale_y };
+        out.x0 = x - half_width;
+        out.y0 = y - half_height;
+        out.x1 = x + half_width;
+        out.y1 = y + half_height;
+        out.depth = res[2] * winv;
+        out.s0 = 0.f;
+        out.t0 = 0.f;
+        out.s1 = 1.f;
+        out.t1 = 1.f;
+        out.color.r = (uint8_t)(int32_t)math::to_real(particles.color[0][n]);
+        out.color.g = (uint8_t)(int32_t)math::to_real(particles.color[1][n]);
+        out.color.b = (uint8_t)(int32_t)math::to_real(particles.color[2][n]);
+        out.color.a = (uint8_t)(int32_t)math::to_real(particles.color[3][n]);
+        return true;
+    };
+
+    uint32_t sprite_count{ 0 };
+    auto add = [&](uint32_t n)
+    {
+        if (project(n, raster_sprite_buffer[sprite_count]) && ++sprite_count == raster_sprite_buffer_size)
+        {
+            prof_geometry.stop();
+            prof_raster.start();
+            raster::scan_sprites(&raster_config, raster_sprite_buffer, sprite_count);
+            prof_raster.stop();
+            prof_geometry.start();
+            sprite_count = 0;
+        }
+    };
+
+    if ((raster_config.flags & raster::BLEND_BIT_MASK) == raster::BLEND_ALPHA)
+    {
+        // radix sort by depth, back to front
+
+        assert(particles.sort_data);
+        uint32_t* key{ particles.sort_data };
+        uint32_t* index{ key + particles.capacity };
+        uint32_t count{ 0 };
+        raster::sprite s;
+        for (uint32_t n{ 0 }; n < particles.count; ++n)
+        {
+            if (project(n, s))
+            {
+                key[count] = particle::sort_key(math::to_float(s.depth));
+                index[count] = n;
+                ++count;
+            }
+        }
+        particle::sort_descending(key, index, index + particles.capacity, index + particles.capacity * 2, count);
+        for (uint32_t n{ 0 }; n < count; ++n)
+            add(index[n]);
+    }
+    else
+    {
+        for (uint32_t n{ 0 }; n < particles.count; ++n)
+            add(n);
+    }
+
+    if (sprite_count)
+    {
         prof_geometry.stop();
         prof_raster.start();
-        raster::scan_faces(&raster_config);
+        raster::scan_sprites(&raster_config, raster_sprite_buffer, sprite_count);
         prof_raster.stop();
         prof_geometry.start();
     }
@@ -633,21 +1554,440 @@ void renderer::render_draw()
 
 //------------------------------------------------------------------------------
 
+void renderer::bin_setup()
+{
+    bin_tile_width = bin_band_callback ? frame_width : bin_tile_setting;
+    bin_tile_height = bin_band_callback ? bin_band_height : bin_tile_setting;
+    bin_tile_count[0] = bin_tile_width ? (frame_width + bin_tile_width - 1) / bin_tile_width : 0;
+    bin_tile_count[1] = bin_tile_height ? (frame_height + bin_tile_height - 1) / bin_tile_height : 0;
+    bin_state_count = 0;
+    bin_face_count = 0;
+    bin_vertex_count = 0;
+    bin_tile_face_count = 0;
+    bin_clear_frame = false;
+    bin_clear_depth = false;
+    if (bin)
+    {
+        uint32_t tile_count{ bin_tile_count[0] * bin_tile_count[1] };
+        for (uint32_t n{ 0 }; n <= tile_count; ++n)
+            bin->tile_face_offset[n] = 0;
+    }
+}
+
+void renderer::bin_flush(bool final)
+{
+    if (bin_face_count == 0 && !bin_clear_frame && !bin_clear_depth)
+        return;
+
+    // bands are drawn once at render_end, they have no frame to load from
+    if (bin_band_callback && !final)
+        return;
+
+    pipeline_drain();
+
+    prof_raster.start();
+
+    // face lists, tile counts to offsets, faces in submission order
+
+    uint32_t tile_count{ bin_tile_count[0] * bin_tile_count[1] };
+    uint32_t* offset{ bin->tile_face_offset };
+    uint32_t sum{ 0 };
+    for (uint32_t n{ 0 }; n < tile_count; ++n)
+    {
+        uint32_t c{ offset[n] };
+        offset[n] = sum;
+        sum += c;
+    }
+    for (uint32_t nf{ 0 }; nf < bin_face_count; ++nf)
+    {
+        const bin_face& f{ bin->face[nf] };
+        for (uint32_t ty{ f.tile_rect[1] }; ty < f.tile_rect[3]; ++ty)
+            for (uint32_t tx{ f.tile_rect[0] }; tx < f.tile_rect[2]; ++tx)
+                bin->tile_face[offset[bin_tile_count[0] * ty + tx]++] = nf;
+    }
+    // now offset[n] is the end of tile n list
+
+    bool store_depth{ !bin_band_callback && (!final || bin_store_depth) };
+    assert(bin_band_callback || bin_clear_depth || frame_depth);
+    assert(!store_depth || frame_depth);
+
+    // tiles are independent, workers take them from a work stealing queue,
+    // bands go to the callback in order on the calling thread
+
+    struct flush_data
+    {
+        renderer* r;
+        thread::work_queue queue;
+        bool store_depth;
+    };
+    flush_data data;
+    data.r = this;
+    data.store_depth = store_depth;
+    uint32_t worker_count{ bin_band_callback ? 1 : thread_pool.get_count() };
+    data.queue.setup(tile_count, worker_count);
+
+    auto flush_job = [](void* p, uint32_t worker)
+    {
+        flush_data& d{ *static_cast<flush_data*>(p) };
+        uint32_t tile;
+        while (d.queue.next(worker, tile))
+            d.r->bin_draw_tile(tile, worker, d.store_depth);
+    };
+    if (worker_count == 1)
+        flush_job(&data, 0);
+    else
+        thread_pool.run(flush_job, &data);
+
+    bin_setup();
+
+    prof_raster.stop();
+}
+
+void renderer::bin_draw_tile(uint32_t tile, uint32_t worker, bool store_depth)
+{
+    bool band{ bin_band_callback != nullptr };
+    uint32_t tx{ tile % bin_tile_count[0] };
+    uint32_t ty{ tile / bin_tile_count[0] };
+    uint32_t tile_x{ tx * bin_tile_width };
+    uint32_t tile_y{ ty * bin_tile_height };
+    uint32_t tile_width{ math::min(bin_tile_width, frame_width - tile_x) };
+    uint32_t tile_height{ math::min(bin_tile_height, frame_height - tile_y) };
+    int32_t x0{ (int32_t)tile_x };
+    int32_t x1{ (int32_t)(tile_x + tile_width) };
+    raster::ARGB* tile_color{ &bin->tile_color[bin_tile_width * bin_tile_height * worker] };
+    float* tile_depth{ &bin->tile_depth[bin_tile_width * bin_tile_height * worker] };
+
+    // load, bands without a pending clear keep the previous band content
+
+    for (uint32_t row{ 0 }; row < tile_height; ++row)
+    {
+        raster::ARGB* dst{ &tile_color[bin_tile_width * row] };
+        if (bin_clear_frame)
+            for (uint32_t n{ 0 }; n < tile_width; ++n)
+                dst[n] = frame_clear_color;
+        else
+        if (!band)
+            raster::frame_row_pieces(frame_blocked, frame_stride, x0, x1, tile_y + row, [&](int32_t offset, int32_t x, int32_t count)
+            {
+                frame_load(&dst[x - x0], &frame_data[offset * pixel_step], pixel_step, count);
+            });
+    }
+    for (uint32_t row{ 0 }; row < tile_height; ++row)
+    {
+        float* dst{ &tile_depth[bin_tile_width * row] };
+        if (bin_clear_depth)
+            for (uint32_t n{ 0 }; n < tile_width; ++n)
+                dst[n] = frame_clear_depth;
+        else
+        if (!band)
+            raster::frame_row_pieces(frame_blocked, frame_stride, x0, x1, tile_y + row, [&](int32_t offset, int32_t x, int32_t count)
+            {
+                frame_load(&dst[x - x0], &frame_depth[offset * pixel_step], pixel_step, count);
+            });
+    }
+
+    // draw, vertices relative to the tile, batches of faces with the same state
+
+    uint32_t* offset{ bin->tile_face_offset };
+    uint32_t begin{ tile ? offset[tile - 1] : 0 };
+    uint32_t end{ offset[tile] };
+    math::real origin[2]{ (math::real)tile_x, (math::real)tile_y };
+
+    uint32_t vertex_count_buffer[raster_face_buffer_size];
+    raster::ARGB face_color_buffer[raster_face_buffer_size];
+    math::real geometry_buffer[raster_geometry_buffer_size];
+    uint32_t face_buffer_index{ 0 };
+    uint32_t geometry_buffer_index{ 0 };
+
+    uint32_t batch_state{ UINT32_MAX };
+    uint32_t batch_flags{};
+    uint32_t batch_stride{};
+
+    auto draw_buffer = [&]()
+    {
+        if (face_buffer_index == 0)
+            return;
+
+        raster::config tile_config{ bin->state[batch_state] };
+        tile_config.face_fill_color = batch_flags != tile_config.flags ? face_color_buffer : nullptr;
+        tile_config.flags = batch_flags;
+        tile_config.num_faces = face_buffer_index;
+        tile_config.vertex_count_data = vertex_count_buffer;
+        tile_config.vertex_data = geometry_buffer;
+        tile_config.vertex_stride = batch_stride;
+        tile_config.frame_width = tile_width;
+        tile_config.frame_height = tile_height;
+        tile_config.frame_stride = bin_tile_width;
+        tile_config.frame_blocked = false;
+        tile_config.pixel_step = 1;
+        tile_config.depth_buffer = tile_depth;
+        tile_config.frame_buffer = tile_color;
+        tile_config.scissor = true;
+        tile_config.coverage_spans = nullptr;
+        tile_config.depth_tile = nullptr;
+        tile_config.occlusion = nullptr;
+        tile_config.fast_clear = nullptr;
+        raster::scan_faces(&tile_config);
+
+        face_buffer_index = 0;
+        geometry_buffer_index = 0;
+    };
+
+    for (uint32_t n{ begin }; n < end; ++n)
+    {
+        const bin_face& f{ bin->face[bin->tile_face[n]] };
+        uint32_t vertex_size{ (uint32_t)f.vertex_count * f.vertex_stride };
+        if (f.state != batch_state || f.flags != batch_flags ||
+            face_buffer_index == raster_face_buffer_size ||
+            geometry_buffer_index + vertex_size > raster_geometry_buffer_size)
+            draw_buffer();
+        batch_state = f.state;
+        batch_flags = f.flags;
+        batch_stride = f.vertex_stride;
+
+        face_color_buffer[face_buffer_index] = f.color;
+        vertex_count_buffer[face_buffer_index++] = f.vertex_count;
+
+        const math::real* in{ &bin->vertex[f.vertex_index] };
+        math::real* out{ &geometry_buffer[geometry_buffer_index] };
+        for (uint32_t nv{ 0 }; nv < f.vertex_count; ++nv)
+        {
+            out[0] = in[0] - origin[0];
+            out[1] = in[1] - origin[1];
+            for (uint32_t nc{ 2 }; nc < f.vertex_stride; ++nc)
+                out[nc] = in[nc];
+            in += f.vertex_stride;
+            out += f.vertex_stride;
+        }
+        geometry_buffer_index += vertex_size;
+    }
+    draw_buffer();
+
+    // store
+
+    if (band)
+    {
+        bin_band_callback(bin_band_user, tile_y, tile_height, tile_color, bin_tile_width);
+        return;
+    }
+    for (uint32_t row{ 0 }; row < tile_height; ++row)
+    {
+        const raster::ARGB* src{ &tile_color[bin_tile_width * row] };
+        raster::frame_row_pieces(frame_blocked, frame_stride, x0, x1, tile_y + row, [&](int32_t offset, int32_t x, int32_t count)
+        {
+            frame_store(&frame_data[offset * pixel_step], &src[x - x0], pixel_step, count);
+        });
+    }
+    if (store_depth)
+    {
+        for (uint32_t row{ 0 }; row < tile_height; ++row)
+        {
+            const float* src{ &tile_depth[bin_tile_width * row] };
+            raster::frame_row_pieces(frame_blocked, frame_stride, x0, x1, tile_y + row, [&](int32_t offset, int32_t x, int32_t count)
+            {
+                frame_store(&frame_depth[offset * pixel_step], &src[x - x0], pixel_step, count);
+            });
+        }
+    }
+}
+
+void renderer::pipeline_drain()
+{
+    if (pipeline_batch)
+        raster_pipeline.drain();
+}
+
+//------------------------------------------------------------------------------
+
+void renderer::clear(bool clear_frame, bool clear_depth)
+{
+    pipeline_drain();
+
+    if (clear_depth)
+    {
+        occlusion_valid = false;
+        raster_config.occlusion = nullptr;
+        if (!bin && raster_config.coverage_spans)
+            for (uint32_t row{ 0 }; row < frame_height; ++row)
+                raster_config.coverage_count[row] = 0;
+
+        // the depth of the previous epochs is behind the range of the next one
+        if (!bin && depth_epoch + 1 < depth_epoch_count)
+        {
+            ++depth_epoch;
+            depth_epoch_update();
+            clear_depth = false;
+        }
+        else
+        if (depth_epoch != 0)
+        {
+            depth_epoch = 0;
+            depth_epoch_update();
+        }
+    }
+
+    if (!clear_frame && !clear_depth)
+        return;
+
+    if (bin)
+    {
+        // applied to the tiles
+        bin_flush(false);
+        bin_clear_frame |= clear_frame;
+        bin_clear_depth |= clear_depth;
+        return;
+    }
+
+    prof_raster.start();
+
+    uint32_t color;
+    uint32_t depth;
+    std::memcpy(&color, &frame_clear_color, sizeof(color));
+    std::memcpy(&depth, &frame_clear_depth, sizeof(depth));
+
+    if (clear_depth && raster_config.depth_tile)
+        cpu::kernels.fill(reinterpret_cast<uint32_t*>(raster_config.depth_tile), depth,
+            frame_height * raster_config.depth_tile_stride * 2);
+
+    if (fast_clear.flags)
+    {
+        fast_clear.color = color;
+        fast_clear.depth = depth;
+        fast_clear_mark((clear_frame ? (uint32_t)raster::FAST_CLEAR_FRAME : 0u) | (clear_depth ? (uint32_t)raster::FAST_CLEAR_DEPTH : 0u));
+    }
+    else
+        clear_buffers(0, 0, frame_width, frame_height, clear_frame, clear_depth);
+
+    prof_raster.stop();
+}
+
+void renderer::clear_buffers(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, bool clear_frame, bool clear_depth)
+{
+    uint32_t color;
+    uint32_t depth;
+    std::memcpy(&color, &frame_clear_color, sizeof(color));
+    std::memcpy(&depth, &frame_clear_depth, sizeof(depth));
+
+    // large clears bypass the cache, one pass over the rows of both buffers
+    uint32_t width{ x1 - x0 };
+    uint32_t size{ width * (y1 - y0) * (uint32_t)(clear_frame + clear_depth) * 4 };
+    bool stream{ size >= clear_stream_size };
+
+    if (frame_blocked || pixel_step != 1)
+    {
+        // blocked rects reaching the frame edge take the padding, whole blocks
+        if (frame_blocked && x1 == frame_width)
+            x1 = (x1 + raster::frame_block_width - 1) & ~(raster::frame_block_width - 1);
+        if (frame_blocked && y1 == frame_height)
+            y1 = (y1 + raster::frame_block_height - 1) & ~(raster::frame_block_height - 1);
+        // interleaved color and depth in one pass
+        if (clear_frame && clear_depth && pixel_step != 1)
+        {
+            raster::frame_fill_rect_interleaved(frame_blocked, frame_stride,
+                reinterpret_cast<raster::depth_ARGB*>(frame_depth), x0, y0, x1, y1, depth, color);
+            return;
+        }
+        if (clear_frame)
+            raster::frame_fill_rect(frame_blocked, frame_stride, pixel_step,
+                reinterpret_cast<uint32_t*>(frame_data), x0, y0, x1, y1, color, stream);
+        if (clear_depth)
+            raster::frame_fill_rect(frame_blocked, frame_stride, pixel_step,
+                reinterpret_cast<uint32_t*>(frame_depth), x0, y0, x1, y1, depth, stream);
+        return;
+    }
+
+    auto fill{ stream ? cpu::kernels.fill_stream : cpu::kernels.fill };
+    for (uint32_t row{ y0 }; row < y1; ++row)
+    {
+        uint32_t start{ frame_stride * row + x0 };
+        if (clear_frame)
+            fill(reinterpret_cast<uint32_t*>(&frame_data[start]), color, width);
+        if (clear_depth)
+            fill(reinterpret_cast<uint32_t*>(&frame_depth[start]), depth, width);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void renderer::depth_epoch_update()
+{
+    // depth - epoch * range, the z row minus offset times the w row
+    depth_epoch_offset = depth_epoch < depth_epoch_count ? -(float)depth_epoch * depth_epoch_range : 0.f;
+    math::mat4x4 matrix_t;
+    math::copy4x4(matrix_t, frame_matrix_t);
+    for (uint32_t n{ 0 }; n < 16; n += 4)
+        matrix_t[n + 2] += depth_epoch_offset * matrix_t[n + 3];
+    math::to_real(post_matrix_t, matrix_t, 16);
+}
+
+//------------------------------------------------------------------------------
+
+void renderer::fast_clear_setup()
+{
+    fast_clear.tile_w = (int32_t)((frame_width + (1u << raster::fast_clear_tile_shift) - 1) >> raster::fast_clear_tile_shift);
+    fast_clear.tile_h = (int32_t)((frame_height + (1u << raster::fast_clear_tile_shift) - 1) >> raster::fast_clear_tile_shift);
+    fast_clear.frame_width = frame_width;
+    fast_clear.frame_height = frame_height;
+    fast_clear.frame_stride = frame_stride;
+    fast_clear.frame_blocked = frame_blocked;
+    fast_clear.pixel_step = pixel_step;
+    fast_clear.depth_buffer = frame_depth;
+    fast_clear.frame_buffer = frame_data;
+}
+
+void renderer::fast_clear_apply(uint32_t mask)
+{
+    if (fast_clear.flags == nullptr)
+        return;
+    pipeline_drain();
+    raster::fast_clear_resolve(fast_clear, mask);
+}
+
+void renderer::fast_clear_mark(uint32_t mask)
+{
+    uint8_t* flags{ fast_clear.flags };
+    uint32_t count{ (uint32_t)(fast_clear.tile_w * fast_clear.tile_h) };
+    for (uint32_t n{ 0 }; n < count; ++n)
+        flags[n] |= (uint8_t)mask;
+    fast_clear.pending |= mask;
+}
+
+//------------------------------------------------------------------------------
+
 void renderer::occlusion_build_mipchain()
 {
+    if (bin_band_callback)
+        return;
+    if (bin)
+        bin_flush(false);
+    pipeline_drain();
+    fast_clear_apply(raster::FAST_CLEAR_DEPTH);
+
     raster::occlusion_build_mipchain(
         occlusion_config,
         occlusion_data);
+    occlusion_valid = true;
+    raster_config.occlusion = &occlusion_data;
 }
 
 bool renderer::occlusion_test_rect(float screen_min[2], float screen_max[2], float depth_min)
 {
+    depth_min += depth_epoch_offset;
+    pipeline_drain();
+    raster::occlusion_update_mipchain(
+        occlusion_config,
+        occlusion_data);
     return raster::occlusion_test_rect(
         occlusion_config,
         occlusion_data,
         screen_min, screen_max, depth_min);
 }
 
+uint32_t renderer::occlusion_get_cull_count()
+{
+    return occlusion_cull_count;
+}
+
 //------------------------------------------------------------------------------
 
 void renderer::gamma_set(float gamma)
@@ -678,6 +2018,10 @@ float renderer::gamma_encode(float linear)
 
 const raster::occlusion_data& renderer::debug_get_occlusion_data()
 {
+    pipeline_drain();
+    raster::occlusion_update_mipchain(
+        occlusion_config,
+        occlusion_data);
     return occlusion_data;
 }
 
@@ -1,5 +1,7 @@
 #pragma once
 #include "raster.hpp"
+#include "particle.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
 #include <float.h>
 
@@ -11,7 +13,7 @@ constexpr uint32_t num_clip_planes{ 7 };
 #else
 constexpr uint32_t num_clip_planes{ 5 };
 #endif
-using clip_interp_type = float;
+using clip_interp_type = math::real;
 constexpr clip_interp_type clip_w_min{ (clip_interp_type)1e-2 };
 // this way input faces when clipped will not exceed raster max vertex count
 constexpr uint32_t num_max_vertices{ raster::num_max_vertices - num_clip_planes };
@@ -23,6 +25,95 @@ struct face
     uint32_t count; // vertex count
 };
 
+struct sprite
+{
+    float center[2]; // screen x y
+    float size[2]; // screen width height
+    float depth; // depth buffer value
+    float tex_rect[4]; // u0 v0 u1 v1 texture coordinate
+    raster::ARGB color; // FILL_SOLID color, FILL_TEXTURE with SHADE_VERTEX modulate color
+};
+
+// transformed and clipped face, screen rect for binning and occlusion cull
+struct stage_face
+{
+    uint32_t flags; // raster flags
+    uint16_t vertex_count;
+    uint16_t drop_count; // uniform components not staged
+    raster::ARGB color; // FILL_SOLID per face color
+    float rect_min[2];
+    float rect_max[2];
+    float rect_depth;
+};
+
+/*
+    parallel geometry memory, see set_geometry_parallel
+    a worker fills one stage with a chunk of consecutive faces, the chunk size is
+    min(face_capacity, vertex_capacity / (raster::num_max_vertices * vertex components)),
+    capacities are the same for all stages, face_count and cull_count are set by render_draw
+*/
+struct geometry_stage
+{
+    stage_face* face;
+    uint32_t face_capacity;
+    math::real* vertex; // components of the visible faces
+    uint32_t vertex_capacity;
+    uint32_t face_count;
+    uint32_t cull_count;
+};
+
+// raster batch, faces staged for one raster::scan_faces call
+constexpr uint32_t batch_face_capacity{ 32 };
+constexpr uint32_t batch_vertex_capacity{ batch_face_capacity * 4 * 8 }; // vertex components
+
+struct raster_batch
+{
+    raster::config config;
+    uint32_t vertex_count[batch_face_capacity];
+    raster::ARGB face_color[batch_face_capacity];
+    math::real vertex[batch_vertex_capacity];
+};
+
+// tile binning, default screen tile width and height
+constexpr uint32_t bin_tile_size{ 64 };
+
+struct bin_face
+{
+    uint32_t state; // draw state index
+    uint32_t flags; // raster flags
+    uint32_t vertex_index; // first vertex component
+    uint16_t vertex_count;
+    uint16_t vertex_stride;
+    raster::ARGB color; // FILL_SOLID per face color
+    uint16_t tile_rect[4]; // covered tiles x0 y0 x1 y1
+};
+
+/*
+    tile binning memory, see set_frame_bin
+    tile_color and tile_depth are tile_size * tile_size * thread count, place them in fast memory
+    tile_face_offset is tile count + 1 elements, tile count is
+    ((width + tile_size - 1) / tile_size) * ((height + tile_size - 1) / tile_size)
+    binned faces are drawn early when a capacity is reached
+*/
+struct bin_buffer
+{
+    raster::ARGB* tile_color;
+    float* tile_depth;
+
+    raster::config* state; // one per render_draw
+    uint32_t state_capacity;
+    bin_face* face;
+    uint32_t face_capacity;
+    math::real* vertex; // post transform vertex components
+    uint32_t vertex_capacity;
+    uint32_t* tile_face; // face index per covered tile
+    uint32_t tile_face_capacity;
+    uint32_t* tile_face_offset;
+};
+
+// band mode, color of the rows [y, y + height), stride in pixels
+using band_callback = void (*)(void* user, uint32_t y, uint32_t height, const raster::ARGB* color, uint32_t stride);
+
 class renderer
 {
 public:
@@ -39,12 +130,93 @@ public:
         float* depth,
         raster::ARGB* frame);
 
+#if defined(USE_FRAME_INTERLEAVED)
+    // interleaved depth and color, one buffer of stride * height pixels, a depth tested
+    // pixel touches one cache line, render_resolve_frame copies the color to a linear buffer,
+    // the occlusion mipchain is stored after the pixels as after a depth buffer
+    void set_frame_interleaved(
+        uint32_t width,
+        uint32_t height,
+        uint32_t stride,
+        raster::depth_ARGB* data);
+#endif
+
+    // blocked layout, color and depth in raster::frame_block_width x frame_block_height
+    // pixel blocks, see raster::frame_offset, faces touch fewer cache lines and pages,
+    // stride is a multiple of frame_block_width, the buffers hold height rounded up to
+    // frame_block_height rows, render_resolve_frame copies the color to a linear buffer
+    void set_frame_blocked(bool blocked);
+
     void set_frame_clear_color(raster::ARGB color);
 
     void set_frame_clear_depth(float depth);
 
     void set_frame_transform(math::mat4x4 matrix); // 4x4
 
+    // depth epochs, render_clear_depth clears the depth buffer once every count calls,
+    // the other calls move the depth output of the frame transform down by range,
+    // so the depth left by the previous epochs is always behind
+    // range is the span of the frame depth values, precision drops as the offset grows,
+    // sprite and occlusion_test_rect depths are moved the same way
+    // with tile binning the depth is cleared every call, count 0 to disable
+    void set_frame_depth_epoch(uint32_t count, float range);
+
+    // span coverage buffer (s-buffer) for opaque faces drawn front to back
+    // spans is height * line_capacity, count is height, cleared with the depth
+    // nullptr to disable
+    void set_frame_coverage(
+        raster::coverage_span* spans,
+        uint32_t* count,
+        uint32_t line_capacity);
+
+    // depth tiles, min max depth per raster::depth_tile_width pixels of a scanline
+    // data is height * ((width + depth_tile_width - 1) / depth_tile_width) * 2, cleared with the depth
+    // nullptr to disable
+    void set_frame_depth_tile(float* data);
+
+    // lazy clear, render_clear_frame and render_clear_depth flag tiles of
+    // raster::fast_clear_tile_shift size, faces and sprites clear a tile when they first
+    // touch it, render_end clears the frame of the tiles not drawn, their depth stays
+    // pending until drawn, cleared again or read (occlusion_build_mipchain)
+    // flags is ((width + 31) / 32) * ((height + 31) / 32), not used with tile binning
+    // nullptr to disable
+    void set_frame_fast_clear(uint8_t* flags);
+
+    // tile binning, render_draw bins the faces and render_end draws them tile by tile,
+    // tiles are shared by the worker threads, see set_thread_count
+    // the frame is read and written once per flush, the depth buffer is written only
+    // if store_depth or when the bins are flushed before render_end (sprites, particles,
+    // outline faces, mipchain build, clears after drawing, full bins)
+    // coverage and depth tiles are not used by binned faces
+    // nullptr to disable
+    void set_frame_bin(bin_buffer* bins, uint32_t tile_size, bool store_depth);
+
+    // band mode, bins as set_frame_bin with full width bands of band_height rows,
+    // tile_color and tile_depth are width * band_height, tile count is the band count,
+    // bands are drawn at render_end and passed to callback in top to bottom order,
+    // the frame and depth buffers are not used (set_frame_data with nullptr)
+    // render_clear_frame and render_clear_depth are required each frame,
+    // sprites, particles and occlusion are not supported,
+    // faces that do not fit in the bins are dropped
+    // nullptr to disable
+    void set_frame_band(bin_buffer* bins, uint32_t band_height, band_callback callback, void* user);
+
+    // pipelined raster, render_draw keeps transforming and clipping while a raster
+    // thread draws the batches in order, count batches are in flight, USE_THREADS only
+    // the batches are drawn before render_end and before any call that reads or writes
+    // the frame (clears, sprites, particles, occlusion, bin flush)
+    // draws with occlusion cull or binning are not pipelined
+    // texture, lightmap and frame data must not change until the batches are drawn
+    // nullptr to disable
+    void set_frame_pipeline(raster_batch* batches, uint32_t count);
+
+    // static layer, a copy of the frame color and depth, see render_store_layer
+    // color and depth are stride * height pixels, height rounded up to
+    // raster::frame_block_height when blocked, depth_tile is the size of the depth tiles
+    // (see set_frame_depth_tile) or nullptr, not in band mode
+    // nullptr to disable
+    void set_frame_layer(raster::ARGB* color, float* depth, float* depth_tile);
+
     //----------------------------------
 
     // vertex x y z coordinate
@@ -73,6 +245,17 @@ public:
 
     void set_geometry_back_cull(bool back_cull);
 
+    // reject faces occluded in the hierarchical z-buffer, see occlusion_build_mipchain
+    // the mipchain is used until the next render_clear_depth
+    void set_geometry_occlusion_cull(bool occlusion_cull);
+
+    // parallel geometry, the worker threads transform and clip chunks of faces into
+    // the stages, the faces are then drawn or binned in submission order
+    // used with more than one thread (see set_thread_count), a round uses count stages,
+    // occlusion cull tests against the hierarchical z-buffer of the round start
+    // nullptr to disable
+    void set_geometry_parallel(geometry_stage* stages, uint32_t count);
+
     //----------------------------------
 
     enum
@@ -81,7 +264,8 @@ public:
         FILL_OUTLINE,
         FILL_SOLID,
         FILL_VERTEX,
-        FILL_TEXTURE
+        FILL_TEXTURE,
+        FILL_CUSTOM
     };
     void set_fill_type(uint32_t setting);
 
@@ -93,11 +277,15 @@ public:
         const raster::ARGB texture_lut[256],
         const uint8_t* texture_data);
 
+    // FILL_CUSTOM, reads tex coord and color, see raster_custom.hpp
+    void set_fill_custom(raster::custom_raster_factory factory);
+
     enum
     {
         SHADE_NONE,
         SHADE_VERTEX,
-        SHADE_LIGHTMAP
+        SHADE_LIGHTMAP,
+        SHADE_VERTEX_LIGHTMAP // vertex light + lightmap, FILL_TEXTURE only
     };
     void set_shade_type(uint32_t setting);
 
@@ -135,18 +323,60 @@ public:
 
     //----------------------------------
 
+    // worker threads including the calling thread, USE_THREADS only
+    // output is the same for any count
+    void set_thread_count(uint32_t count);
+
+    uint32_t get_thread_count();
+
+    //----------------------------------
+
     void render_begin();
 
     void render_clear_frame();
 
     void render_clear_depth();
 
+    // render_clear_frame and render_clear_depth in one pass over the rows
+    void render_clear();
+
+    // rect x0 y0 inclusive, x1 y1 exclusive, not in band mode
+    void render_clear_rect(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, bool clear_frame, bool clear_depth);
+
+    // copy the frame color and depth to the layer after drawing the static geometry,
+    // version is a user value that changes with the camera and the static content
+    void render_store_layer(uint32_t version);
+
+    // copy the layer to the frame in place of render_clear, then draw the dynamic geometry
+    // false if no layer of version is stored or the frame size, layout or depth
+    // epochs changed since, then clear, draw the static geometry and store it again
+    bool render_load_layer(uint32_t version);
+
     void render_draw();
 
+    // screen aligned rects, FILL_SOLID or FILL_TEXTURE, no mip
+    // skips transform and clipping, draws with constant depth and affine texture mapping
+    void render_sprites(const sprite* sprites, uint32_t count);
+
+    // color and depth image in the sprite rect, written at image depth + sprite depth,
+    // depth tested, the fill and blend settings do not apply, see raster::depth_image
+    void render_depth_image(const raster::depth_image& image, const sprite& sp);
+
+    // particles as sprites facing the view, size is projected from world size
+    // FILL_SOLID or FILL_TEXTURE, color is the sprite color
+    // BLEND_ALPHA draws back to front, other blend modes in buffer order
+    void render_particles(particle::buffer& particles);
+
     void render_end();
 
+    // copy the frame color to a linear buffer, stride in pixels, after render_end
+    // not in band mode
+    void render_resolve_frame(raster::ARGB* dst, uint32_t dst_stride);
+
     //----------------------------------
 
+    // the mipchain then follows depth writes until the next render_clear_depth,
+    // written cells are rebuilt on query
     void occlusion_build_mipchain();
 
     bool occlusion_test_rect(
@@ -154,6 +384,9 @@ public:
         float screen_max[2],
         float depth_min);
 
+    // faces rejected by geometry occlusion cull since render_begin
+    uint32_t occlusion_get_cull_count();
+
     //----------------------------------
 
     void gamma_set(float gamma);
@@ -175,11 +408,64 @@ private:
     uint32_t frame_width{};
     uint32_t frame_height{};
     uint32_t frame_stride{};
+    uint32_t pixel_step{ 1 };
+    bool frame_blocked{};
     float* frame_depth{};
     raster::ARGB* frame_data{};
     raster::ARGB frame_clear_color{};
     float frame_clear_depth{ FLT_MAX };
 
+    void set_frame_buffers(
+        uint32_t width,
+        uint32_t height,
+        uint32_t stride,
+        float* depth,
+        raster::ARGB* frame,
+        uint32_t step);
+
+    bin_buffer* bin{};
+    bool bin_store_depth{};
+    uint32_t bin_tile_setting{ bin_tile_size };
+    uint32_t bin_tile_width{};
+    uint32_t bin_tile_height{};
+    uint32_t bin_band_height{};
+    band_callback bin_band_callback{};
+    void* bin_band_user{};
+    bool bin_clear_frame{};
+    bool bin_clear_depth{};
+    uint32_t bin_tile_count[2]{};
+    uint32_t bin_state_count{};
+    uint32_t bin_face_count{};
+    uint32_t bin_vertex_count{};
+    uint32_t bin_tile_face_count{};
+
+    void bin_setup();
+    void bin_flush(bool final);
+    void bin_draw_tile(uint32_t tile, uint32_t worker, bool store_depth);
+
+    raster::fast_clear_data fast_clear{};
+
+    void fast_clear_setup();
+    void fast_clear_apply(uint32_t mask);
+    void fast_clear_mark(uint32_t mask);
+
+    raster::ARGB* layer_color{};
+    float* layer_depth{};
+    float* layer_depth_tile{};
+    bool layer_valid{};
+    uint32_t layer_version{};
+    uint32_t layer_depth_epoch{};
+
+    raster_batch* pipeline_batch{};
+
+    void pipeline_drain();
+
+    // clears of at least this many bytes use non-temporal stores
+    static constexpr uint32_t clear_stream_size{ 1u << 20 };
+
+    void clear(bool clear_frame, bool clear_depth);
+    void clear_buffers(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, bool clear_frame, bool clear_depth);
+
     float* geometry_coord_data{};
     uint32_t geometry_coord_stride{};
     float* geometry_color_data{};
@@ -194,26 +480,46 @@ private:
     uint32_t geometry_face_count{};
     uint32_t* geometry_face_index{};
     uint32_t geometry_face_index_count{};
+    bool geometry_occlusion_cull{};
+    geometry_stage* geometry_stage_data{};
+    uint32_t geometry_stage_count{};
+
+    math::real pre_matrix_t[16]{};
+    math::real post_matrix_t[16]{};
+    math::mat4x4 frame_matrix_t{};
 
-    math::mat4x4 pre_matrix_t{};
-    math::mat4x4 post_matrix_t{};
+    uint32_t depth_epoch_count{};
+    uint32_t depth_epoch{};
+    float depth_epoch_range{};
+    float depth_epoch_offset{};
+
+    void depth_epoch_update();
 
     raster::config raster_config{};
 
-    float render_buffer[2][raster::num_max_vertices][num_max_components];
+    math::real render_buffer[2][raster::num_max_vertices][num_max_components];
 
-    static constexpr uint32_t raster_face_buffer_size{ 32 };
-    static constexpr uint32_t raster_geometry_buffer_size{ raster_face_buffer_size * 4 * 8 };
+    static constexpr uint32_t raster_face_buffer_size{ batch_face_capacity };
+    static constexpr uint32_t raster_geometry_buffer_size{ batch_vertex_capacity };
     uint32_t raster_vertex_count_buffer[raster_face_buffer_size];
-    float raster_geometry_buffer[raster_geometry_buffer_size];
+    raster::ARGB raster_face_color_buffer[raster_face_buffer_size];
+    math::real raster_geometry_buffer[raster_geometry_buffer_size];
     uint32_t raster_face_buffer_index{};
     uint32_t raster_geometry_buffer_index{};
     //uint32_t raster_geometry_vertex_index{};
 
+    static constexpr uint32_t raster_sprite_buffer_size{ 64 };
+    raster::sprite raster_sprite_buffer[raster_sprite_buffer_size];
+
     raster::occlusion_config occlusion_config;
     raster::occlusion_data occlusion_data;
+    bool occlusion_valid{};
+    uint32_t occlusion_cull_count{};
 
     float gamma_value{ 1.f };
+
+    thread::pool thread_pool;
+    thread::pipe raster_pipeline; // last, stopped before the other members
 };
 
 } // namespace blib3d::render
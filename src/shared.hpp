@@ -3,11 +3,11 @@
 
 // architecture
 
-#ifdef _M_IX86
+#if defined(_M_IX86) || defined(__i386__)
 #define ARCH_X86
 #endif
 
-#ifdef _M_X64
+#if defined(_M_X64) || defined(__x86_64__)
 #define ARCH_X64
 #endif
 
@@ -25,7 +25,7 @@
 #elif defined(__GNUC__)
 
 #define no_inline __attribute__((noinline))
-#define force_inline __attribute__((always_inline))
+#define force_inline inline __attribute__((always_inline))
 
 #else
 
@@ -37,3 +37,17 @@
 
 #define USE_SIMD
 
+// scan_face edge walking in 28.4 fixed point, exact and watertight
+//#define USE_SCAN_FIXED
+
+// geometry and raster in 32.32 fixed point math (see fixed.hpp), for targets without FPU
+// renderer input and depth buffer are still float, converted with integer operations
+//#define USE_FIXED_POINT
+
+// worker threads (see thread.hpp), needs std::thread
+//#define USE_THREADS
+
+// interleaved depth and color frame (see renderer::set_frame_interleaved),
+// a second instance of the span fill loops
+//#define USE_FRAME_INTERLEAVED
+
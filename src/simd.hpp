@@ -0,0 +1,163 @@
+#pragma once
+#include "shared.hpp"
+#include <cstring>
+
+/*
+    4 lane float and uint32 vectors for the USE_SIMD paths
+    GCC/Clang: vector extensions, the compiler emits SSE, AVX, NEON or Helium
+    code for the target, or scalar code when there is no vector unit
+    MSVC on ARCH_INTEL: SSE intrinsics
+    MSVC on other targets: scalar lanes
+*/
+
+#if defined(__GNUC__)
+#define SIMD_VECTOR_EXTENSIONS
+#elif defined(ARCH_INTEL)
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+namespace blib3d::simd
+{
+
+#if defined(SIMD_VECTOR_EXTENSIONS)
+
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+
+force_inline f32x4 load(const float* p) { f32x4 v; std::memcpy(&v, p, sizeof(v)); return v; }
+force_inline u32x4 load(const uint32_t* p) { u32x4 v; std::memcpy(&v, p, sizeof(v)); return v; }
+force_inline void store(float* p, f32x4 v) { std::memcpy(p, &v, sizeof(v)); }
+force_inline void store(uint32_t* p, u32x4 v) { std::memcpy(p, &v, sizeof(v)); }
+
+force_inline f32x4 set1(float a) { return f32x4{ a, a, a, a }; }
+force_inline u32x4 set1(uint32_t a) { return u32x4{ a, a, a, a }; }
+
+// lanes i0..i3, 0..3 from a, 4..7 from b
+template<int i0, int i1, int i2, int i3>
+force_inline f32x4 shuffle(f32x4 a, f32x4 b)
+{
+#if defined(__clang__)
+    return __builtin_shufflevector(a, b, i0, i1, i2, i3);
+#else
+    return __builtin_shuffle(a, b, i32x4{ i0, i1, i2, i3 });
+#endif
+}
+
+// all ones lanes where a > b
+force_inline u32x4 cmpgt(f32x4 a, f32x4 b) { return (u32x4)(a > b); }
+
+force_inline u32x4 select(u32x4 m, u32x4 a, u32x4 b) { return (a & m) | (b & ~m); }
+force_inline f32x4 select(u32x4 m, f32x4 a, f32x4 b) { return (f32x4)select(m, (u32x4)a, (u32x4)b); }
+
+#elif defined(SIMD_SSE)
+
+struct f32x4 { __m128 v; };
+struct u32x4 { __m128i v; };
+
+force_inline f32x4 operator+(f32x4 a, f32x4 b) { return { _mm_add_ps(a.v, b.v) }; }
+force_inline f32x4 operator-(f32x4 a, f32x4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+force_inline f32x4 operator*(f32x4 a, f32x4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+
+force_inline f32x4 load(const float* p) { return { _mm_loadu_ps(p) }; }
+force_inline u32x4 load(const uint32_t* p) { return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) }; }
+force_inline void store(float* p, f32x4 v) { _mm_storeu_ps(p, v.v); }
+force_inline void store(uint32_t* p, u32x4 v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v.v); }
+
+force_inline f32x4 set1(float a) { return { _mm_set1_ps(a) }; }
+force_inline u32x4 set1(uint32_t a) { return { _mm_set1_epi32((int32_t)a) }; }
+
+template<int i0, int i1, int i2, int i3>
+force_inline f32x4 shuffle(f32x4 a, f32x4 b)
+{
+    // two lanes from each source in order, or interleaved low or high halves
+    if constexpr (i0 < 4 && i1 < 4 && i2 >= 4 && i3 >= 4)
+        return { _mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(i3 - 4, i2 - 4, i1, i0)) };
+    else if constexpr (i0 == 0 && i1 == 4 && i2 == 1 && i3 == 5)
+        return { _mm_unpacklo_ps(a.v, b.v) };
+    else
+    {
+        static_assert(i0 == 2 && i1 == 6 && i2 == 3 && i3 == 7, "unsupported shuffle");
+        return { _mm_unpackhi_ps(a.v, b.v) };
+    }
+}
+
+force_inline u32x4 cmpgt(f32x4 a, f32x4 b) { return { _mm_castps_si128(_mm_cmpgt_ps(a.v, b.v)) }; }
+
+force_inline u32x4 select(u32x4 m, u32x4 a, u32x4 b)
+{
+    return { _mm_or_si128(_mm_and_si128(m.v, a.v), _mm_andnot_si128(m.v, b.v)) };
+}
+force_inline f32x4 select(u32x4 m, f32x4 a, f32x4 b)
+{
+    __m128 mf{ _mm_castsi128_ps(m.v) };
+    return { _mm_or_ps(_mm_and_ps(mf, a.v), _mm_andnot_ps(mf, b.v)) };
+}
+
+#else
+
+struct f32x4 { float v[4]; };
+struct u32x4 { uint32_t v[4]; };
+
+force_inline f32x4 operator+(f32x4 a, f32x4 b) { return { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] }; }
+force_inline f32x4 operator-(f32x4 a, f32x4 b) { return { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] }; }
+force_inline f32x4 operator*(f32x4 a, f32x4 b) { return { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] }; }
+
+force_inline f32x4 load(const float* p) { return { p[0], p[1], p[2], p[3] }; }
+force_inline u32x4 load(const uint32_t* p) { return { p[0], p[1], p[2], p[3] }; }
+force_inline void store(float* p, f32x4 v) { std::memcpy(p, v.v, sizeof(v.v)); }
+force_inline void store(uint32_t* p, u32x4 v) { std::memcpy(p, v.v, sizeof(v.v)); }
+
+force_inline f32x4 set1(float a) { return { a, a, a, a }; }
+force_inline u32x4 set1(uint32_t a) { return { a, a, a, a }; }
+
+template<int i0, int i1, int i2, int i3>
+force_inline f32x4 shuffle(f32x4 a, f32x4 b)
+{
+    const float* s[2]{ a.v, b.v };
+    return { s[i0 >> 2][i0 & 3], s[i1 >> 2][i1 & 3], s[i2 >> 2][i2 & 3], s[i3 >> 2][i3 & 3] };
+}
+
+force_inline u32x4 cmpgt(f32x4 a, f32x4 b)
+{
+    return { a.v[0] > b.v[0] ? ~0u : 0u, a.v[1] > b.v[1] ? ~0u : 0u, a.v[2] > b.v[2] ? ~0u : 0u, a.v[3] > b.v[3] ? ~0u : 0u };
+}
+
+force_inline u32x4 select(u32x4 m, u32x4 a, u32x4 b)
+{
+    u32x4 r;
+    for (uint32_t n{ 0 }; n < 4; ++n)
+        r.v[n] = (a.v[n] & m.v[n]) | (b.v[n] & ~m.v[n]);
+    return r;
+}
+force_inline f32x4 select(u32x4 m, f32x4 a, f32x4 b)
+{
+    f32x4 r;
+    for (uint32_t n{ 0 }; n < 4; ++n)
+        r.v[n] = m.v[n] ? a.v[n] : b.v[n];
+    return r;
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+// common
+
+// lane n in all lanes
+template<int n>
+force_inline f32x4 splat(f32x4 a) { return shuffle<n, n, n + 4, n + 4>(a, a); }
+
+// a < b ? a : b, a > b ? a : b per lane, as minps maxps
+force_inline f32x4 min(f32x4 a, f32x4 b) { return select(cmpgt(b, a), a, b); }
+force_inline f32x4 max(f32x4 a, f32x4 b) { return select(cmpgt(a, b), a, b); }
+
+// a0 b0 a1 b1, a2 b2 a3 b3
+force_inline f32x4 interleave_lo(f32x4 a, f32x4 b) { return shuffle<0, 4, 1, 5>(a, b); }
+force_inline f32x4 interleave_hi(f32x4 a, f32x4 b) { return shuffle<2, 6, 3, 7>(a, b); }
+
+// a0 a1 b0 b1, a2 a3 b2 b3
+force_inline f32x4 concat_lo(f32x4 a, f32x4 b) { return shuffle<0, 1, 4, 5>(a, b); }
+force_inline f32x4 concat_hi(f32x4 a, f32x4 b) { return shuffle<2, 3, 6, 7>(a, b); }
+
+} // namespace blib3d::simd
@@ -0,0 +1,252 @@
+#include "thread.hpp"
+#include <cassert>
+
+namespace blib3d::thread
+{
+
+//------------------------------------------------------------------------------
+
+pool::pool()
+{
+}
+
+pool::~pool()
+{
+    set_count(1);
+}
+
+void pool::set_count(uint32_t count)
+{
+    assert(count >= 1 && count <= max_count);
+#if defined(USE_THREADS)
+    if (count == worker_count)
+        return;
+
+    // stop the current workers
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    start_cv.notify_all();
+    for (uint32_t n{ 1 }; n < worker_count; ++n)
+        workers[n].join();
+
+    quit = false;
+    worker_count = count;
+    for (uint32_t n{ 1 }; n < worker_count; ++n)
+        workers[n] = std::thread(&pool::worker_main, this, n, generation);
+#else
+    (void)count;
+#endif
+}
+
+void pool::run(job j, void* data)
+{
+#if defined(USE_THREADS)
+    if (worker_count > 1)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current_job = j;
+            current_data = data;
+            pending = worker_count - 1;
+            generation++;
+        }
+        start_cv.notify_all();
+
+        j(data, 0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this] { return pending == 0; });
+        return;
+    }
+#endif
+    j(data, 0);
+}
+
+#if defined(USE_THREADS)
+void pool::worker_main(uint32_t worker, uint64_t seen)
+{
+    for (;;)
+    {
+        job j;
+        void* data;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [this, seen] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+            j = current_job;
+            data = current_data;
+        }
+
+        j(data, worker);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            done_cv.notify_one();
+    }
+}
+#endif
+
+//------------------------------------------------------------------------------
+
+void work_queue::setup(uint32_t count, uint32_t worker_count)
+{
+    range_count = worker_count;
+    for (uint32_t n{ 0 }; n < worker_count; ++n)
+    {
+        uint64_t begin{ (uint64_t)count * n / worker_count };
+        uint64_t end{ (uint64_t)count * (n + 1) / worker_count };
+        range[n] = begin | (end << 32);
+    }
+}
+
+bool work_queue::next(uint32_t worker, uint32_t& item)
+{
+#if defined(USE_THREADS)
+    // own range front
+    uint64_t r{ range[worker].load(std::memory_order_relaxed) };
+    while ((uint32_t)r < (uint32_t)(r >> 32))
+    {
+        if (range[worker].compare_exchange_weak(r, r + 1, std::memory_order_relaxed))
+        {
+            item = (uint32_t)r;
+            return true;
+        }
+    }
+
+    // other ranges back
+    for (uint32_t n{ 1 }; n < range_count; ++n)
+    {
+        std::atomic<uint64_t>& victim{ range[(worker + n) % range_count] };
+        uint64_t v{ victim.load(std::memory_order_relaxed) };
+        while ((uint32_t)v < (uint32_t)(v >> 32))
+        {
+            if (victim.compare_exchange_weak(v, v - ((uint64_t)1 << 32), std::memory_order_relaxed))
+            {
+                item = (uint32_t)(v >> 32) - 1;
+                return true;
+            }
+        }
+    }
+    return false;
+#else
+    for (uint32_t n{ 0 }; n < range_count; ++n)
+    {
+        uint64_t& r{ range[(worker + n) % range_count] };
+        if ((uint32_t)r < (uint32_t)(r >> 32))
+        {
+            item = (uint32_t)r;
+            r++;
+            return true;
+        }
+    }
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+pipe::pipe()
+{
+}
+
+pipe::~pipe()
+{
+    setup(0, nullptr, nullptr);
+}
+
+void pipe::setup(uint32_t capacity, slot_job consume, void* data)
+{
+#if defined(USE_THREADS)
+    if (consumer.joinable())
+    {
+        drain();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake_cv.notify_one();
+        consumer.join();
+        quit = false;
+    }
+    slot_capacity = consume ? capacity : 0;
+    consume_job = consume;
+    consume_data = data;
+    head = 0;
+    tail = 0;
+    if (slot_capacity)
+        consumer = std::thread(&pipe::consumer_main, this);
+#else
+    slot_capacity = consume && capacity ? 1 : 0;
+    consume_job = consume;
+    consume_data = data;
+#endif
+}
+
+uint32_t pipe::acquire()
+{
+    assert(slot_capacity);
+#if defined(USE_THREADS)
+    uint32_t h{ head.load(std::memory_order_relaxed) };
+    while (h - tail.load(std::memory_order_acquire) == slot_capacity)
+        std::this_thread::yield();
+    return h % slot_capacity;
+#else
+    return 0;
+#endif
+}
+
+void pipe::submit()
+{
+#if defined(USE_THREADS)
+    head.store(head.load(std::memory_order_relaxed) + 1);
+    // pairs with the consumer storing sleeping before reading head
+    if (sleeping.load())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake_cv.notify_one();
+    }
+#else
+    consume_job(consume_data, 0);
+#endif
+}
+
+void pipe::drain()
+{
+#if defined(USE_THREADS)
+    if (!slot_capacity)
+        return;
+    uint32_t h{ head.load(std::memory_order_relaxed) };
+    while (tail.load(std::memory_order_acquire) != h)
+        std::this_thread::yield();
+#endif
+}
+
+#if defined(USE_THREADS)
+void pipe::consumer_main()
+{
+    uint32_t t{ tail.load(std::memory_order_relaxed) };
+    for (;;)
+    {
+        if (head.load(std::memory_order_acquire) == t)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping = true;
+            wake_cv.wait(lock, [this, t] { return quit || head.load() != t; });
+            sleeping = false;
+            if (head.load(std::memory_order_acquire) == t)
+                return; // quit with nothing left
+        }
+
+        consume_job(consume_data, t % slot_capacity);
+        tail.store(++t, std::memory_order_release);
+    }
+}
+#endif
+
+//------------------------------------------------------------------------------
+
+} // namespace blib3d::thread
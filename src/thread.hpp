@@ -0,0 +1,139 @@
+#pragma once
+#include "shared.hpp"
+#if defined(USE_THREADS)
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace blib3d::thread
+{
+
+constexpr uint32_t max_count{ 16 };
+
+// job run by every worker, worker 0 is the calling thread
+using job = void (*)(void* data, uint32_t worker);
+
+// pipe consumer, called with the index of the slot to consume
+using slot_job = void (*)(void* data, uint32_t slot);
+
+//------------------------------------------------------------------------------
+
+/*
+    persistent worker threads, without USE_THREADS the count is always 1
+    and jobs run on the calling thread
+*/
+class pool
+{
+public:
+    pool();
+
+    ~pool();
+
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+
+    // worker count including the calling thread, 1 to max_count
+    void set_count(uint32_t count);
+
+    uint32_t get_count() { return worker_count; }
+
+    // run j on all workers, return when all are done
+    void run(job j, void* data);
+
+private:
+    uint32_t worker_count{ 1 };
+
+#if defined(USE_THREADS)
+    // seen is the generation at start, a later run is not missed
+    void worker_main(uint32_t worker, uint64_t seen);
+
+    std::thread workers[max_count];
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    job current_job{};
+    void* current_data{};
+    uint64_t generation{};
+    uint32_t pending{};
+    bool quit{};
+#endif
+};
+
+//------------------------------------------------------------------------------
+
+/*
+    items [0, count) split in contiguous ranges, one per worker
+    a worker takes items from the front of its range, when empty it steals
+    from the back of the other ranges
+*/
+class work_queue
+{
+public:
+    void setup(uint32_t count, uint32_t worker_count);
+
+    // false when no item is left
+    bool next(uint32_t worker, uint32_t& item);
+
+private:
+    uint32_t range_count{};
+
+#if defined(USE_THREADS)
+    std::atomic<uint64_t> range[max_count]; // begin | end << 32
+#else
+    uint64_t range[max_count];
+#endif
+};
+
+//------------------------------------------------------------------------------
+
+/*
+    single producer single consumer ring of slot indices, a dedicated thread
+    consumes the slots in submission order, slot memory is owned by the user
+    head and tail are lock free, an idle consumer sleeps, a waiting producer yields
+    without USE_THREADS there is one slot consumed on submit by the calling thread
+*/
+class pipe
+{
+public:
+    pipe();
+
+    ~pipe();
+
+    pipe(const pipe&) = delete;
+    pipe& operator=(const pipe&) = delete;
+
+    // slot count, 0 stops the consumer thread
+    void setup(uint32_t capacity, slot_job consume, void* data);
+
+    uint32_t get_capacity() { return slot_capacity; }
+
+    // slot to fill, waits while all slots are in use
+    uint32_t acquire();
+
+    // pass the acquired slot to the consumer
+    void submit();
+
+    // wait until all submitted slots are consumed
+    void drain();
+
+private:
+    uint32_t slot_capacity{};
+    slot_job consume_job{};
+    void* consume_data{};
+
+#if defined(USE_THREADS)
+    void consumer_main();
+
+    std::thread consumer;
+    std::atomic<uint32_t> head{}; // submitted count
+    std::atomic<uint32_t> tail{}; // consumed count
+    std::atomic<bool> sleeping{};
+    std::atomic<bool> quit{};
+    std::mutex mutex;
+    std::condition_variable wake_cv;
+#endif
+};
+
+} // namespace blib3d::thread